@@ -0,0 +1,220 @@
+// Fan-out throughput of FanoutWorker: one publisher thread, 1..N worker hubs
+// and a set of client hubs on the same machine. For each worker count the
+// publisher sends frames as fast as the clients receive them (at most
+// MAX_FRAMES_IN_FLIGHT ahead) and the delivered frames, messages and bytes
+// per second are printed.
+//
+// usage: FanoutBenchmark [clients] [payload bytes] [seconds] [worker counts...]
+// (thousands of clients need a raised open files limit, see ulimit -n)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FanoutWorker.h"
+#include "PreparedFrame.h"
+
+namespace
+{
+	constexpr const int BASE_PORT = 9109;
+	constexpr const uint64_t MAX_FRAMES_IN_FLIGHT = 4;
+	constexpr const int CONNECT_TIMEOUT_SECONDS = 30;
+
+	struct alignas(64) ClientCounters
+	{
+		std::atomic<uint64_t> connections{0};
+		std::atomic<uint64_t> messages{0};
+		std::atomic<uint64_t> bytes{0};
+	};
+
+	// a thread with a client hub connecting its share of the clients
+	class ClientThread
+	{
+		public:
+			ClientThread(int port, int clientCount)
+			{
+				std::promise<void> started;
+				auto result = started.get_future();
+				_thread = std::thread([this, port, clientCount, &started]() {
+					uWS::Hub hub;
+					hub.onConnection([this](uWS::WebSocket<uWS::CLIENT>*, uWS::HttpRequest) {
+						_counters.connections.fetch_add(1, std::memory_order_relaxed);
+					});
+					hub.onMessage([this](uWS::WebSocket<uWS::CLIENT>*, char*, size_t length, uWS::OpCode) {
+						_counters.messages.fetch_add(1, std::memory_order_relaxed);
+						_counters.bytes.fetch_add(length, std::memory_order_relaxed);
+					});
+
+					_async = new uS::Async(hub.getLoop());
+					_async->setData(&hub);
+					_async->start([](uS::Async* async) {
+						static_cast<uWS::Hub*>(async->getData())->getDefaultGroup<uWS::CLIENT>().close();
+						async->close();
+					});
+					started.set_value();
+
+					std::string uri = "ws://127.0.0.1:" + std::to_string(port);
+					for (int i=0; i<clientCount; i++)
+					{
+						hub.connect(uri);
+					}
+					hub.run();
+				});
+				result.get();
+			}
+
+			~ClientThread()
+			{
+				_async->send();
+				_thread.join();
+			}
+
+			const ClientCounters& GetCounters() const { return _counters; }
+
+		private:
+			std::thread _thread;
+			uS::Async* _async = nullptr;
+			ClientCounters _counters;
+	};
+
+	template <class F>
+	uint64_t sum(const std::vector<std::unique_ptr<ClientThread>>& threads, F field)
+	{
+		uint64_t result = 0;
+		for (auto& thread: threads)
+		{
+			result += field(thread->GetCounters()).load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	bool run(int port, int workerCount, int clientCount, size_t payloadSize, int seconds)
+	{
+		std::vector<std::unique_ptr<FanoutWorker>> workers;
+		for (int i=0; i<workerCount; i++)
+		{
+			workers.push_back(std::make_unique<FanoutWorker>(
+				[](FanoutWorker&, uWS::Hub&) {},
+				[](FanoutWorker&, uWS::Group<uWS::SERVER>& group, const FrameData& frame, bool)
+				{
+					PreparedFrame prepared(frame.json, uWS::OpCode::TEXT, false);
+					group.forEach([&prepared](uWS::WebSocket<uWS::SERVER>* ws) {
+						for (auto* msg: prepared.GetMessages())
+						{
+							ws->sendPrepared(msg);
+						}
+					});
+				}
+			));
+			if (!workers.back()->Start(port))
+			{
+				fprintf(stderr, "worker %d failed to listen on port %d\n", i, port);
+				return false;
+			}
+		}
+
+		int clientThreadCount = std::max(1, std::min(clientCount, static_cast<int>(std::thread::hardware_concurrency() / 2)));
+		std::vector<std::unique_ptr<ClientThread>> clients;
+		for (int i=0; i<clientThreadCount; i++)
+		{
+			int share = clientCount / clientThreadCount + ((i < clientCount % clientThreadCount) ? 1 : 0);
+			clients.push_back(std::make_unique<ClientThread>(port, share));
+		}
+
+		auto connections = [&clients]() { return sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.connections; }); };
+		auto messages = [&clients]() { return sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.messages; }); };
+		auto bytes = [&clients]() { return sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.bytes; }); };
+
+		auto connectDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(CONNECT_TIMEOUT_SECONDS);
+		while (connections() < static_cast<uint64_t>(clientCount))
+		{
+			if (std::chrono::steady_clock::now() > connectDeadline)
+			{
+				fprintf(stderr, "only %llu of %d clients connected\n", static_cast<unsigned long long>(connections()), clientCount);
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		auto frame = std::make_shared<FrameData>();
+		frame->json.data.assign(payloadSize, 'x');
+		frame->json.items.emplace_back(0, payloadSize);
+
+		uint64_t frames = 0;
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::seconds(seconds);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			if (frames > MAX_FRAMES_IN_FLIGHT && (frames - MAX_FRAMES_IN_FLIGHT) * clientCount > messages())
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			for (auto& worker: workers)
+			{
+				worker->Publish(frame);
+			}
+			frames++;
+		}
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		uint64_t delivered = messages();
+		uint64_t deliveredBytes = bytes();
+
+		uint64_t dropped = 0;
+		for (auto& worker: workers)
+		{
+			dropped += worker->GetDroppedFrames();
+		}
+
+		printf("%7d %10.0f %12.0f %10.1f %8llu\n",
+			workerCount,
+			static_cast<double>(delivered) / clientCount / elapsed,
+			delivered / elapsed,
+			deliveredBytes / elapsed / (1024*1024),
+			static_cast<unsigned long long>(dropped));
+		fflush(stdout);
+
+		// clients disconnect before the workers shut down
+		clients.clear();
+		workers.clear();
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int clientCount = (argc > 1) ? atoi(argv[1]) : 1000;
+	size_t payloadSize = (argc > 2) ? static_cast<size_t>(atol(argv[2])) : 16*1024;
+	int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+
+	std::vector<int> workerCounts;
+	for (int i=4; i<argc; i++)
+	{
+		workerCounts.push_back(atoi(argv[i]));
+	}
+	if (workerCounts.empty())
+	{
+		int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency() / 2));
+		for (int count=1; count<=cores; count*=2)
+		{
+			workerCounts.push_back(count);
+		}
+	}
+
+	printf("%d clients, %zu byte payload, %d s per run\n", clientCount, payloadSize, seconds);
+	printf("workers   frames/s   messages/s       MiB/s  dropped\n");
+	for (size_t i=0; i<workerCounts.size(); i++)
+	{
+		if (!run(BASE_PORT + static_cast<int>(i), workerCounts[i], clientCount, payloadSize, seconds))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,503 @@
+// End-to-end load test of the relay executable: a synthetic gameserver
+// thread streams frames at a fixed tick rate, the relay is started as a
+// child process connected to it, and a swarm of headless websocket clients
+// connects to the relay. Reported are the sustained ticks/s at the
+// generator and at the clients, the tick delivery latency (generator send
+// to client receive) percentiles, the egress payload and the relay's RSS.
+//
+// usage: LoadTest <relay executable> [--clients N] [--bots N] [--food N]
+//        [--segments N] [--log-lines N] [--tick-rate HZ] [--seconds S]
+//        [--client-threads N] [--port N] [--bundle]
+// (thousands of clients need a raised open files limit, see ulimit -n)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <uWS.h>
+#include "SyntheticGame.h"
+
+namespace
+{
+	constexpr const int CONNECT_TIMEOUT_SECONDS = 30;
+	constexpr const int WARMUP_SECONDS = 1;
+	// send times of the most recent frames, indexed by frame id
+	constexpr const size_t SEND_TIME_SLOTS = 4096;
+	// the Tick is the last message of a frame, so its frame id is near the end
+	constexpr const size_t FRAME_ID_SEARCH_BYTES = 64;
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		const char* relay = nullptr;
+		SyntheticGame::Config game;
+		int clients = 100;
+		int clientThreads = 0;
+		double tickRate = 60;
+		int seconds = 10;
+		int port = 9209;
+		bool bundle = false;
+	};
+
+	int64_t nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	class SendTimes
+	{
+		public:
+			void Set(uint64_t frame_id, int64_t timeUs)
+			{
+				auto& slot = _slots[frame_id % SEND_TIME_SLOTS];
+				slot.frame_id.store(~0ULL, std::memory_order_relaxed);
+				slot.timeUs.store(timeUs, std::memory_order_relaxed);
+				slot.frame_id.store(frame_id, std::memory_order_release);
+			}
+
+			// -1 when the frame is too old to be known any more
+			int64_t Get(uint64_t frame_id) const
+			{
+				auto& slot = _slots[frame_id % SEND_TIME_SLOTS];
+				if (slot.frame_id.load(std::memory_order_acquire) != frame_id) { return -1; }
+				int64_t timeUs = slot.timeUs.load(std::memory_order_relaxed);
+				return (slot.frame_id.load(std::memory_order_acquire) == frame_id) ? timeUs : -1;
+			}
+
+		private:
+			struct Slot
+			{
+				std::atomic<uint64_t> frame_id{~0ULL};
+				std::atomic<int64_t> timeUs{0};
+			};
+			std::array<Slot, SEND_TIME_SLOTS> _slots;
+	};
+
+	bool sendAll(int fd, const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+			if (sent < 0)
+			{
+				if (errno == EINTR) { continue; }
+				return false;
+			}
+			data += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	// serves the synthetic game to the first connection at a fixed tick rate
+	class GameServerThread
+	{
+		public:
+			GameServerThread(const SyntheticGame::Config& config, double tickRate, SendTimes& sendTimes)
+				: _game(config), _tickRate(tickRate), _sendTimes(sendTimes)
+			{
+			}
+
+			~GameServerThread()
+			{
+				_stop = true;
+				if (_listenSocket >= 0) { shutdown(_listenSocket, SHUT_RDWR); }
+				if (_thread.joinable()) { _thread.join(); }
+				if (_listenSocket >= 0) { close(_listenSocket); }
+			}
+
+			bool Listen(int port)
+			{
+				_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+				if (_listenSocket < 0)
+				{
+					perror("socket");
+					return false;
+				}
+				int enable = 1;
+				setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+				struct sockaddr_in addr;
+				memset(&addr, 0, sizeof(addr));
+				addr.sin_family = AF_INET;
+				addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				addr.sin_port = htons(static_cast<uint16_t>(port));
+				if ((bind(_listenSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(_listenSocket, 1) != 0))
+				{
+					perror("gameserver listen");
+					return false;
+				}
+				_thread = std::thread([this]() { run(); });
+				return true;
+			}
+
+			uint64_t GetFramesSent() const { return _framesSent.load(std::memory_order_relaxed); }
+			uint64_t GetBytesSent() const { return _bytesSent.load(std::memory_order_relaxed); }
+
+		private:
+			SyntheticGame _game;
+			double _tickRate;
+			SendTimes& _sendTimes;
+			int _listenSocket = -1;
+			std::thread _thread;
+			std::atomic<bool> _stop{false};
+			std::atomic<uint64_t> _framesSent{0};
+			std::atomic<uint64_t> _bytesSent{0};
+
+			void run()
+			{
+				int fd = accept(_listenSocket, nullptr, nullptr);
+				if (fd < 0)
+				{
+					if (!_stop) { perror("gameserver accept"); }
+					return;
+				}
+
+				std::string buf;
+				_game.WriteWelcome(buf);
+				bool connected = sendAll(fd, buf.data(), buf.size());
+
+				auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / _tickRate));
+				auto next = Clock::now();
+				while (connected && !_stop)
+				{
+					buf.clear();
+					uint64_t frame_id = _game.WriteFrame(buf);
+					std::this_thread::sleep_until(next);
+					next += interval;
+
+					_sendTimes.Set(frame_id, nowUs());
+					connected = sendAll(fd, buf.data(), buf.size());
+					_framesSent.fetch_add(1, std::memory_order_relaxed);
+					_bytesSent.fetch_add(buf.size(), std::memory_order_relaxed);
+				}
+				if (!_stop) { fprintf(stderr, "relay disconnected from the gameserver\n"); }
+				close(fd);
+			}
+	};
+
+	struct alignas(64) ClientCounters
+	{
+		std::atomic<uint64_t> connections{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<uint64_t> ticks{0};
+		std::atomic<uint64_t> messages{0};
+		std::atomic<uint64_t> bytes{0};
+	};
+
+	// a thread with a client hub connecting its share of the clients
+	class ClientThread
+	{
+		public:
+			ClientThread(const std::string& uri, int clientCount, const SendTimes& sendTimes, const std::atomic<bool>& measuring)
+				: _sendTimes(sendTimes), _measuring(measuring)
+			{
+				std::promise<void> started;
+				auto result = started.get_future();
+				_thread = std::thread([this, uri, clientCount, &started]() {
+					uWS::Hub hub;
+					hub.onConnection([this](uWS::WebSocket<uWS::CLIENT>*, uWS::HttpRequest) {
+						_counters.connections.fetch_add(1, std::memory_order_relaxed);
+					});
+					hub.onError([this](void*) {
+						_counters.errors.fetch_add(1, std::memory_order_relaxed);
+					});
+					hub.onMessage([this](uWS::WebSocket<uWS::CLIENT>*, char* message, size_t length, uWS::OpCode) {
+						onMessage(message, length);
+					});
+
+					_async = new uS::Async(hub.getLoop());
+					_async->setData(&hub);
+					_async->start([](uS::Async* async) {
+						static_cast<uWS::Hub*>(async->getData())->getDefaultGroup<uWS::CLIENT>().close();
+						async->close();
+					});
+					started.set_value();
+
+					for (int i=0; i<clientCount; i++)
+					{
+						hub.connect(uri);
+					}
+					hub.run();
+				});
+				result.get();
+			}
+
+			~ClientThread()
+			{
+				Stop();
+			}
+
+			// disconnects all clients of this thread
+			void Stop()
+			{
+				if (!_thread.joinable()) { return; }
+				_async->send();
+				_thread.join();
+			}
+
+			const ClientCounters& GetCounters() const { return _counters; }
+			// only valid after Stop()
+			const std::vector<int64_t>& GetLatencies() const { return _latenciesUs; }
+
+		private:
+			const SendTimes& _sendTimes;
+			const std::atomic<bool>& _measuring;
+			std::thread _thread;
+			uS::Async* _async = nullptr;
+			ClientCounters _counters;
+			std::vector<int64_t> _latenciesUs;
+
+			void onMessage(const char* message, size_t length)
+			{
+				if (!_measuring.load(std::memory_order_relaxed)) { return; }
+				_counters.messages.fetch_add(1, std::memory_order_relaxed);
+				_counters.bytes.fetch_add(length, std::memory_order_relaxed);
+
+				static const char key[] = "{\"frame_id\":";
+				size_t searchStart = (length > FRAME_ID_SEARCH_BYTES) ? length - FRAME_ID_SEARCH_BYTES : 0;
+				const char* tail = message + searchStart;
+				const char* end = message + length;
+				const char* found = std::search(tail, end, key, key + sizeof(key) - 1);
+				if (found == end) { return; }
+
+				int64_t receivedUs = nowUs();
+				uint64_t frame_id = 0;
+				for (const char* p = found + sizeof(key) - 1; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+				{
+					frame_id = frame_id * 10 + static_cast<uint64_t>(*p - '0');
+				}
+				_counters.ticks.fetch_add(1, std::memory_order_relaxed);
+				int64_t sentUs = _sendTimes.Get(frame_id);
+				if (sentUs >= 0)
+				{
+					_latenciesUs.push_back(receivedUs - sentUs);
+				}
+			}
+	};
+
+	template <class F>
+	uint64_t sum(const std::vector<std::unique_ptr<ClientThread>>& threads, F field)
+	{
+		uint64_t result = 0;
+		for (auto& thread: threads)
+		{
+			result += field(thread->GetCounters()).load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	pid_t startRelay(const Options& options)
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			return -1;
+		}
+		if (pid == 0)
+		{
+			setenv("GAMESERVER_HOST", "127.0.0.1", 1);
+			setenv("GAMESERVER_PORT", std::to_string(options.port).c_str(), 1);
+			setenv("WEBSOCKET_PORT", std::to_string(options.port + 1).c_str(), 1);
+			execl(options.relay, options.relay, static_cast<char*>(nullptr));
+			perror("could not start the relay");
+			_exit(127);
+		}
+		return pid;
+	}
+
+	bool waitForPort(int port, pid_t relay)
+	{
+		auto deadline = Clock::now() + std::chrono::seconds(CONNECT_TIMEOUT_SECONDS);
+		while (Clock::now() < deadline)
+		{
+			if (waitpid(relay, nullptr, WNOHANG) == relay)
+			{
+				fprintf(stderr, "the relay exited during startup\n");
+				return false;
+			}
+
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			struct sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = htons(static_cast<uint16_t>(port));
+			bool connected = (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+			close(fd);
+			if (connected) { return true; }
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		fprintf(stderr, "the relay did not open port %d\n", port);
+		return false;
+	}
+
+	// VmRSS and VmHWM of a process in kB, from /proc/<pid>/status
+	bool readMemoryUsage(pid_t pid, long& rss, long& peak)
+	{
+		std::string path = "/proc/" + std::to_string(pid) + "/status";
+		FILE* f = fopen(path.c_str(), "r");
+		if (!f) { return false; }
+		char line[256];
+		rss = peak = -1;
+		while (fgets(line, sizeof(line), f))
+		{
+			sscanf(line, "VmRSS: %ld kB", &rss);
+			sscanf(line, "VmHWM: %ld kB", &peak);
+		}
+		fclose(f);
+		return (rss >= 0) && (peak >= 0);
+	}
+
+	double percentile(const std::vector<int64_t>& sorted, double p)
+	{
+		if (sorted.empty()) { return 0; }
+		size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())));
+		return static_cast<double>(sorted[index]) / 1000.0;
+	}
+
+	int run(const Options& options)
+	{
+		SendTimes sendTimes;
+		GameServerThread gameServer(options.game, options.tickRate, sendTimes);
+		if (!gameServer.Listen(options.port))
+		{
+			return 1;
+		}
+
+		pid_t relay = startRelay(options);
+		if ((relay < 0) || !waitForPort(options.port + 1, relay))
+		{
+			return 1;
+		}
+
+		std::atomic<bool> measuring{false};
+		std::string uri = "ws://127.0.0.1:" + std::to_string(options.port + 1) + "/";
+		if (options.bundle) { uri += "?bundle=1"; }
+		int clientThreadCount = (options.clientThreads > 0) ? options.clientThreads
+			: std::max(1, std::min(options.clients, static_cast<int>(std::thread::hardware_concurrency() / 2)));
+		std::vector<std::unique_ptr<ClientThread>> clients;
+		for (int i=0; i<clientThreadCount; i++)
+		{
+			int share = options.clients / clientThreadCount + ((i < options.clients % clientThreadCount) ? 1 : 0);
+			clients.push_back(std::make_unique<ClientThread>(uri, share, sendTimes, measuring));
+		}
+
+		auto connections = [&clients]() { return sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.connections; }); };
+		auto errors = [&clients]() { return sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.errors; }); };
+		auto connectDeadline = Clock::now() + std::chrono::seconds(CONNECT_TIMEOUT_SECONDS);
+		while (connections() + errors() < static_cast<uint64_t>(options.clients))
+		{
+			if (Clock::now() > connectDeadline) { break; }
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (errors() > 0)
+		{
+			fprintf(stderr, "%llu clients failed to connect\n", static_cast<unsigned long long>(errors()));
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+
+		uint64_t framesBefore = gameServer.GetFramesSent();
+		uint64_t upstreamBefore = gameServer.GetBytesSent();
+		auto start = Clock::now();
+		measuring = true;
+		std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+		measuring = false;
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		uint64_t frames = gameServer.GetFramesSent() - framesBefore;
+		uint64_t upstream = gameServer.GetBytesSent() - upstreamBefore;
+
+		long rss = 0, peak = 0;
+		bool haveMemory = readMemoryUsage(relay, rss, peak);
+
+		uint64_t connected = connections();
+		uint64_t ticks = sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.ticks; });
+		uint64_t messages = sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.messages; });
+		uint64_t bytes = sum(clients, [](const ClientCounters& c) -> const std::atomic<uint64_t>& { return c.bytes; });
+
+		std::vector<int64_t> latencies;
+		for (auto& client: clients)
+		{
+			client->Stop();
+			latencies.insert(latencies.end(), client->GetLatencies().begin(), client->GetLatencies().end());
+		}
+		std::sort(latencies.begin(), latencies.end());
+
+		kill(relay, SIGTERM);
+		waitpid(relay, nullptr, 0);
+
+		double clientCount = static_cast<double>(std::max<uint64_t>(1, connected));
+		printf("%llu of %d clients connected, %zu bots, %zu food, %.0f Hz, %s\n",
+			static_cast<unsigned long long>(connected), options.clients, options.game.bots, options.game.food,
+			options.tickRate, options.bundle ? "tick bundles" : "one message per item");
+		printf("generator      %10.1f ticks/s  %10.2f MB/s upstream\n", frames / elapsed, upstream / elapsed / 1e6);
+		printf("clients        %10.1f ticks/s per client, %.0f messages/s\n", ticks / clientCount / elapsed, messages / elapsed);
+		printf("latency        p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  (%zu samples)\n",
+			percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999), latencies.size());
+		printf("egress         %10.2f MB/s  %.0f bytes per client and tick\n",
+			bytes / elapsed / 1e6, (ticks > 0) ? static_cast<double>(bytes) / static_cast<double>(ticks) : 0.0);
+		if (haveMemory)
+		{
+			printf("relay memory   %10.1f MiB RSS  %.1f MiB peak\n", rss / 1024.0, peak / 1024.0);
+		}
+		return (connected == static_cast<uint64_t>(options.clients)) ? 0 : 1;
+	}
+
+	bool parseOptions(int argc, char* argv[], Options& options)
+	{
+		if (argc < 2) { return false; }
+		options.relay = argv[1];
+		for (int i=2; i<argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--bundle")
+			{
+				options.bundle = true;
+				continue;
+			}
+			if (i+1 >= argc) { return false; }
+			const char* value = argv[++i];
+			if (arg == "--clients") { options.clients = atoi(value); }
+			else if (arg == "--bots") { options.game.bots = strtoul(value, nullptr, 10); }
+			else if (arg == "--food") { options.game.food = strtoul(value, nullptr, 10); }
+			else if (arg == "--segments") { options.game.segments = strtoul(value, nullptr, 10); }
+			else if (arg == "--log-lines") { options.game.logLines = strtoul(value, nullptr, 10); }
+			else if (arg == "--tick-rate") { options.tickRate = atof(value); }
+			else if (arg == "--seconds") { options.seconds = atoi(value); }
+			else if (arg == "--client-threads") { options.clientThreads = atoi(value); }
+			else if (arg == "--port") { options.port = atoi(value); }
+			else { return false; }
+		}
+		return (options.clients > 0) && (options.tickRate > 0) && (options.seconds > 0) && (options.game.segments > 0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: %s <relay executable> [--clients N] [--bots N] [--food N] [--segments N]\n"
+			"       [--log-lines N] [--tick-rate HZ] [--seconds S] [--client-threads N] [--port N] [--bundle]\n", argv[0]);
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	return run(options);
+}
@@ -0,0 +1,359 @@
+// Microbenchmarks of the per-message hot paths on realistic payloads: the
+// upstream decoding and state update in TcpProtocol (per message type, and
+// per frame once the decoder's buffers are warmed up),
+// the world state snapshots (MakeWorldUpdateMessage, WriteWorldUpdate,
+// PackWorldUpdate) and the JSON encoding of each message type with both
+// nlohmann::json and JsonWriter. The payloads are generated by
+// SyntheticGame or read from a recording made with RECORD_FILE.
+//
+// Reported per benchmark are ns/op, the payload bytes per op (decoded input
+// or encoded output), and the heap bytes and allocations per op. These are
+// counted by interposing malloc, calloc and realloc (glibc), so they include
+// operator new as well as msgpack zones and buffers, which use malloc directly.
+// A realloc counts as an allocation of its new size.
+//
+// usage: MicroBenchmark [--recording FILE] [--frames N] [--passes N]
+//        [--bots N] [--food N] [--segments N] [--log-lines N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "JsonProtocol.h"
+#include "JsonWriter.h"
+#include "MsgPackVisitors.h"
+#include "StreamReplay.h"
+#include "SyntheticGame.h"
+#include "TcpProtocol.h"
+
+namespace
+{
+	// the benchmark is single threaded
+	uint64_t allocationCount = 0;
+	uint64_t allocationBytes = 0;
+}
+
+extern "C"
+{
+	// glibc's implementations, the definitions below replace the public names for the whole process
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* p, size_t size);
+
+	void* malloc(size_t size) noexcept
+	{
+		allocationCount++;
+		allocationBytes += size;
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size) noexcept
+	{
+		allocationCount++;
+		allocationBytes += count * size;
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* p, size_t size) noexcept
+	{
+		allocationCount++;
+		allocationBytes += size;
+		return __libc_realloc(p, size);
+	}
+}
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	using MsgPackProtocol::Message;
+
+	struct Options
+	{
+		const char* recording = nullptr;
+		size_t frames = 1000;
+		size_t passes = 10;
+		SyntheticGame::Config game;
+	};
+
+	struct Result
+	{
+		uint64_t ops = 0;
+		uint64_t ns = 0;
+		uint64_t payloadBytes = 0;
+		uint64_t allocations = 0;
+		uint64_t allocatedBytes = 0;
+	};
+
+	// results in order of first use
+	class Results
+	{
+		public:
+			Result& operator[](const std::string& name)
+			{
+				auto it = _index.find(name);
+				if (it != _index.end()) { return _results[it->second].second; }
+				_index[name] = _results.size();
+				_results.emplace_back(name, Result());
+				return _results.back().second;
+			}
+
+			void Print() const
+			{
+				printf("%-36s %10s %12s %12s %12s %10s\n", "benchmark", "ops", "ns/op", "payload B/op", "alloc B/op", "allocs/op");
+				for (auto& entry: _results)
+				{
+					const Result& r = entry.second;
+					double ops = static_cast<double>(std::max<uint64_t>(1, r.ops));
+					printf("%-36s %10llu %12.1f %12.1f %12.1f %10.2f\n",
+						entry.first.c_str(), static_cast<unsigned long long>(r.ops),
+						r.ns / ops, r.payloadBytes / ops, r.allocatedBytes / ops, r.allocations / ops);
+				}
+			}
+
+		private:
+			std::map<std::string, size_t> _index;
+			std::vector<std::pair<std::string, Result>> _results;
+	};
+
+	// runs f once and adds it as ops operations with the given payload to result
+	template <class F>
+	void measure(Result& result, uint64_t ops, F f)
+	{
+		uint64_t allocations = allocationCount;
+		uint64_t allocatedBytes = allocationBytes;
+		auto start = Clock::now();
+		size_t payloadBytes = f();
+		auto end = Clock::now();
+		result.ops += ops;
+		result.ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		result.payloadBytes += payloadBytes;
+		result.allocations += allocationCount - allocations;
+		result.allocatedBytes += allocationBytes - allocatedBytes;
+	}
+
+	std::string typeName(uint64_t message_type)
+	{
+		const char* name = MsgPackProtocol::messageTypeName(message_type);
+		return name ? name : "type " + std::to_string(message_type);
+	}
+
+	template <class T>
+	std::unique_ptr<Message> convert(const msgpack::object& obj)
+	{
+		auto msg = std::make_unique<T>();
+		obj.convert(*msg);
+		return std::move(msg);
+	}
+
+	// the message object of an upstream message, for the encoding benchmarks
+	std::unique_ptr<Message> decode(const char* data, size_t count, uint64_t message_type)
+	{
+		msgpack::object_handle obj;
+		msgpack::unpack(obj, data, count);
+		switch (message_type)
+		{
+			case MsgPackProtocol::MESSAGE_TYPE_GAME_INFO: return convert<MsgPackProtocol::GameInfoMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_WORLD_UPDATE: return convert<MsgPackProtocol::WorldUpdateMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_TICK: return convert<MsgPackProtocol::TickMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_SPAWN: return convert<MsgPackProtocol::BotSpawnMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_KILL: return convert<MsgPackProtocol::BotKillMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE: return convert<MsgPackProtocol::BotMoveMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_LOG: return convert<MsgPackProtocol::BotLogMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_STATS: return convert<MsgPackProtocol::BotStatsMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD: return convert<MsgPackProtocol::BotMoveHeadMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_FOOD_SPAWN: return convert<MsgPackProtocol::FoodSpawnMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_FOOD_CONSUME: return convert<MsgPackProtocol::FoodConsumeMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_FOOD_DECAY: return convert<MsgPackProtocol::FoodDecayMessage>(obj.get());
+			case MsgPackProtocol::MESSAGE_TYPE_PLAYER_INFO: return convert<MsgPackProtocol::PlayerInfoMessage>(obj.get());
+		}
+		return nullptr;
+	}
+
+	// the upstream stream as frames of length-prefixed messages
+	bool loadFrames(const Options& options, std::vector<std::string>& frames)
+	{
+		if (options.recording)
+		{
+			StreamReplay replay;
+			if (!replay.Open(options.recording)) { return false; }
+			replay.SetSpeed(0);
+			const char* data;
+			size_t size;
+			while ((frames.size() < options.frames) && replay.NextFrame(data, size))
+			{
+				frames.emplace_back(data, size);
+			}
+			return !frames.empty();
+		}
+
+		SyntheticGame game(options.game);
+		frames.emplace_back();
+		game.WriteWelcome(frames.back());
+		while (frames.size() < options.frames)
+		{
+			frames.emplace_back();
+			game.WriteFrame(frames.back());
+		}
+		return true;
+	}
+
+	template <class F>
+	bool forEachMessage(const std::string& frame, F callback)
+	{
+		const char* data = frame.data();
+		size_t size = frame.size();
+		while (size >= 4)
+		{
+			uint32_t length;
+			memcpy(&length, data, sizeof(length));
+			size_t messageSize = 4 + ntohl(length);
+			if (messageSize > size) { return false; }
+			callback(data, messageSize);
+			data += messageSize;
+			size -= messageSize;
+		}
+		return (size == 0);
+	}
+
+	void run(const Options& options)
+	{
+		std::vector<std::string> frames;
+		if (!loadFrames(options, frames))
+		{
+			fprintf(stderr, "no frames to benchmark\n");
+			return;
+		}
+
+		Results results;
+		std::map<uint64_t, std::vector<std::unique_ptr<Message>>> messages;
+		TcpProtocol proto;
+		proto.SetFrameCompleteCallback([&proto](uint64_t) { proto.ClearLogItems(); });
+
+		// decoding has to follow the stream to keep the state consistent, so it runs once
+		for (auto& frame: frames)
+		{
+			forEachMessage(frame, [&](const char* data, size_t size) {
+				uint64_t message_type;
+				if (!MsgPackVisitors::PeekMessageType(data+4, size-4, message_type)) { return; }
+				measure(results["decode/" + typeName(message_type)], 1, [&]() {
+					proto.Process(data, size);
+					return size;
+				});
+				auto msg = decode(data+4, size-4, message_type);
+				if (msg) { messages[message_type].push_back(std::move(msg)); }
+			});
+		}
+
+		// whole frames on a decoder warmed up with the first half of them: its arena, zone
+		// and buffers have seen frames of this size, so this is what a frame costs from then on
+		TcpProtocol steady;
+		steady.SetFrameCompleteCallback([&steady](uint64_t) { steady.ClearLogItems(); });
+		for (size_t i=0; i<frames.size(); i++)
+		{
+			auto& frame = frames[i];
+			if (i < frames.size() / 2)
+			{
+				steady.Process(frame.data(), frame.size());
+				continue;
+			}
+			measure(results["frame/steady state"], 1, [&]() {
+				steady.Process(frame.data(), frame.size());
+				return frame.size();
+			});
+		}
+
+		for (size_t pass=0; pass<options.passes; pass++)
+		{
+			measure(results["world/MakeWorldUpdateMessage"], 1, [&]() {
+				auto msg = proto.MakeWorldUpdateMessage();
+				return sizeof(*msg) + msg->bots.size() * sizeof(BotItem) + msg->food.size() * sizeof(FoodItem);
+			});
+
+			std::string json;
+			measure(results["world/WriteWorldUpdate"], 1, [&]() {
+				JsonWriter writer(json);
+				proto.WriteWorldUpdate(writer);
+				return json.size();
+			});
+
+			msgpack::sbuffer buf;
+			measure(results["world/PackWorldUpdate"], 1, [&]() {
+				proto.PackWorldUpdate(buf);
+				return buf.size();
+			});
+		}
+
+		for (auto& entry: messages)
+		{
+			std::string name = typeName(entry.first);
+			auto& list = entry.second;
+			std::string buf;
+			for (size_t pass=0; pass<options.passes; pass++)
+			{
+				measure(results["to_json/json/" + name], list.size(), [&]() {
+					size_t bytes = 0;
+					for (auto& msg: list)
+					{
+						nlohmann::json j;
+						MsgPackProtocol::to_json(j, *msg);
+						bytes += j.dump().size();
+					}
+					return bytes;
+				});
+
+				measure(results["to_json/JsonWriter/" + name], list.size(), [&]() {
+					size_t bytes = 0;
+					for (auto& msg: list)
+					{
+						buf.clear();
+						JsonWriter writer(buf);
+						MsgPackProtocol::to_json(writer, *msg);
+						bytes += buf.size();
+					}
+					return bytes;
+				});
+			}
+		}
+
+		printf("%zu frames from %s, %zu passes\n", frames.size(), options.recording ? options.recording : "synthetic game", options.passes);
+		results.Print();
+	}
+
+	bool parseOptions(int argc, char* argv[], Options& options)
+	{
+		for (int i=1; i<argc; i++)
+		{
+			std::string arg = argv[i];
+			if (i+1 >= argc) { return false; }
+			const char* value = argv[++i];
+			if (arg == "--recording") { options.recording = value; }
+			else if (arg == "--frames") { options.frames = strtoul(value, nullptr, 10); }
+			else if (arg == "--passes") { options.passes = strtoul(value, nullptr, 10); }
+			else if (arg == "--bots") { options.game.bots = strtoul(value, nullptr, 10); }
+			else if (arg == "--food") { options.game.food = strtoul(value, nullptr, 10); }
+			else if (arg == "--segments") { options.game.segments = strtoul(value, nullptr, 10); }
+			else if (arg == "--log-lines") { options.game.logLines = strtoul(value, nullptr, 10); }
+			else { return false; }
+		}
+		return (options.frames > 0) && (options.passes > 0) && (options.game.segments > 0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: %s [--recording FILE] [--frames N] [--passes N]\n"
+			"       [--bots N] [--food N] [--segments N] [--log-lines N]\n", argv[0]);
+		return 2;
+	}
+	run(options);
+	return 0;
+}
@@ -0,0 +1,178 @@
+#include "SyntheticGame.h"
+#include <math.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+namespace
+{
+	constexpr const real_t STEP_DISTANCE = 1;
+	constexpr const real_t MAX_TURN = 0.2f;
+	// food eaten and decayed per frame, and twice as much respawned
+	constexpr const size_t FOOD_CHURN_DIVISOR = 500;
+}
+
+SyntheticGame::SyntheticGame(const Config &config)
+	: _config(config), _random(config.seed)
+{
+	std::uniform_real_distribution<real_t> angle(0, 2 * static_cast<real_t>(M_PI));
+	for (size_t i=0; i<_config.bots; i++)
+	{
+		Bot bot;
+		auto& item = bot.item;
+		item.guid = _nextGuid++;
+		item.name = "bot " + std::to_string(i);
+		item.database_id = static_cast<int>(i);
+		item.face_id = 0;
+		item.dog_tag_id = 0;
+		item.color = { 0xff0000, 0x00ff00 };
+		item.mass = 10;
+		item.segment_radius = 2;
+		bot.heading = angle(_random);
+
+		Vector2D pos = randomPosition();
+		Vector2D step(cos(bot.heading) * STEP_DISTANCE, sin(bot.heading) * STEP_DISTANCE);
+		for (size_t s=0; s<_config.segments; s++)
+		{
+			Vector2D segment = pos - step * static_cast<real_t>(s);
+			item.segments.push_back({ item.guid, Vector2D(wrap(segment.x()), wrap(segment.y())) });
+		}
+		_bots.push_back(std::move(bot));
+	}
+
+	for (size_t i=0; i<_config.food; i++)
+	{
+		_food.push_back(makeFood());
+	}
+}
+
+void SyntheticGame::WriteWelcome(std::string &out) const
+{
+	MsgPackProtocol::GameInfoMessage gameInfo;
+	gameInfo.world_size_x = _config.worldSize;
+	gameInfo.world_size_y = _config.worldSize;
+	gameInfo.food_decay_per_frame = 0.001;
+	gameInfo.snake_distance_per_step = STEP_DISTANCE;
+	gameInfo.snake_segment_distance_factor = 0.2;
+	gameInfo.snake_segment_distance_exponent = 0.3;
+	gameInfo.snake_pull_factor = 0.1;
+	append(out, gameInfo);
+
+	MsgPackProtocol::WorldUpdateMessage worldUpdate;
+	for (auto& bot: _bots)
+	{
+		worldUpdate.bots.push_back(bot.item);
+	}
+	worldUpdate.food = _food;
+	append(out, worldUpdate);
+}
+
+uint64_t SyntheticGame::WriteFrame(std::string &out)
+{
+	std::vector<std::unique_ptr<MsgPackProtocol::Message>> messages;
+	uint64_t frame_id = MakeFrame(messages);
+	for (auto& msg: messages)
+	{
+		append(out, *msg);
+	}
+	return frame_id;
+}
+
+uint64_t SyntheticGame::MakeFrame(std::vector<std::unique_ptr<MsgPackProtocol::Message>> &messages)
+{
+	std::uniform_real_distribution<real_t> turn(-MAX_TURN, MAX_TURN);
+
+	auto move = std::make_unique<MsgPackProtocol::BotMoveMessage>();
+	auto moveHead = std::make_unique<MsgPackProtocol::BotMoveHeadMessage>();
+	for (auto& bot: _bots)
+	{
+		auto& item = bot.item;
+		bot.heading += turn(_random);
+		const Vector2D& head = item.segments.front().position;
+		Vector2D newHead(wrap(head.x() + cos(bot.heading) * STEP_DISTANCE), wrap(head.y() + sin(bot.heading) * STEP_DISTANCE));
+
+		MsgPackProtocol::SnakeSegmentItem segment { item.guid, newHead };
+		item.segments.prepend(&segment, &segment + 1);
+		item.segments.resize(_config.segments);
+
+		move->items.push_back({ item.guid, { segment }, _config.segments, item.segment_radius });
+		moveHead->items.push_back({ item.guid, item.mass, { newHead } });
+	}
+	messages.push_back(std::move(move));
+	messages.push_back(std::move(moveHead));
+
+	size_t churn = std::max<size_t>(1, _config.food / FOOD_CHURN_DIVISOR);
+	auto consume = std::make_unique<MsgPackProtocol::FoodConsumeMessage>();
+	auto decay = std::make_unique<MsgPackProtocol::FoodDecayMessage>();
+	for (size_t i=0; (i<churn*2) && !_food.empty(); i++)
+	{
+		size_t index = std::uniform_int_distribution<size_t>(0, _food.size()-1)(_random);
+		guid_t id = _food[index].guid;
+		_food[index] = _food.back();
+		_food.pop_back();
+
+		if ((i % 2 == 0) && !_bots.empty())
+		{
+			consume->items.push_back({ id, _bots[i / 2 % _bots.size()].item.guid });
+		}
+		else
+		{
+			decay->food_ids.push_back(id);
+		}
+	}
+	messages.push_back(std::move(consume));
+	messages.push_back(std::move(decay));
+
+	auto spawn = std::make_unique<MsgPackProtocol::FoodSpawnMessage>();
+	while (_food.size() < _config.food)
+	{
+		_food.push_back(makeFood());
+		spawn->new_food.push_back(_food.back());
+	}
+	messages.push_back(std::move(spawn));
+
+	if ((_config.logLines > 0) && !_bots.empty())
+	{
+		auto log = std::make_unique<MsgPackProtocol::BotLogMessage>();
+		for (size_t i=0; i<_config.logLines; i++)
+		{
+			size_t bot = (_frame_id * _config.logLines + i) % _bots.size();
+			log->items.push_back({ GetViewerKey(bot), "frame " + std::to_string(_frame_id) + ": heading for the nearest food" });
+		}
+		messages.push_back(std::move(log));
+	}
+
+	auto tick = std::make_unique<MsgPackProtocol::TickMessage>();
+	tick->frame_id = _frame_id;
+	messages.push_back(std::move(tick));
+	return _frame_id++;
+}
+
+Vector2D SyntheticGame::randomPosition()
+{
+	std::uniform_real_distribution<real_t> coordinate(0, static_cast<real_t>(_config.worldSize));
+	real_t x = coordinate(_random);
+	real_t y = coordinate(_random);
+	return Vector2D(x, y);
+}
+
+MsgPackProtocol::FoodItem SyntheticGame::makeFood()
+{
+	std::uniform_real_distribution<real_t> value(0.5f, 3.0f);
+	return { _nextGuid++, randomPosition(), value(_random) };
+}
+
+real_t SyntheticGame::wrap(real_t value) const
+{
+	real_t size = static_cast<real_t>(_config.worldSize);
+	value = fmodf(value, size);
+	return (value < 0) ? value + size : value;
+}
+
+void SyntheticGame::append(std::string &out, const MsgPackProtocol::Message &msg)
+{
+	msgpack::sbuffer buf;
+	MsgPackProtocol::pack(buf, msg);
+	uint32_t length = htonl(static_cast<uint32_t>(buf.size()));
+	out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+	out.append(buf.data(), buf.size());
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "MsgPackProtocol.h"
+
+// generates a gameserver's message stream in the upstream wire format
+// (length-prefixed msgpack): bots moving in random walks, food being
+// eaten, decaying and respawning, bot log lines, one Tick per frame.
+class SyntheticGame
+{
+	public:
+		struct Config
+		{
+			size_t bots = 100;
+			size_t food = 5000;
+			// snake length in segments
+			size_t segments = 50;
+			// BotLog lines per frame, spread over the bots
+			size_t logLines = 1;
+			double worldSize = 2048;
+			uint32_t seed = 1;
+		};
+
+		explicit SyntheticGame(const Config& config);
+
+		// GameInfo and WorldUpdate, as sent to a newly connected relay
+		void WriteWelcome(std::string& out) const;
+		// appends all messages of the next frame, ending with its Tick. Returns the frame id.
+		uint64_t WriteFrame(std::string& out);
+		// the message objects of the next frame, for benchmarks that skip the wire format
+		uint64_t MakeFrame(std::vector<std::unique_ptr<MsgPackProtocol::Message>>& messages);
+
+		// viewer key of the bot the log lines of index belong to
+		static uint64_t GetViewerKey(size_t botIndex) { return botIndex + 1; }
+
+	private:
+		struct Bot
+		{
+			MsgPackProtocol::BotItem item;
+			real_t heading;
+		};
+
+		Config _config;
+		std::mt19937 _random;
+		std::vector<Bot> _bots;
+		std::vector<MsgPackProtocol::FoodItem> _food;
+		guid_t _nextGuid = 1;
+		uint64_t _frame_id = 0;
+
+		Vector2D randomPosition();
+		MsgPackProtocol::FoodItem makeFood();
+		real_t wrap(real_t value) const;
+		static void append(std::string& out, const MsgPackProtocol::Message& msg);
+};
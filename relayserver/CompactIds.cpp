@@ -0,0 +1,174 @@
+#include "CompactIds.h"
+#include "TcpProtocol.h"
+
+namespace
+{
+	// how long removed entities keep their id, longer than the interval of the slowest rate class
+	constexpr const int RETAIN_REMOVED_MS = 3000;
+}
+
+void CompactIds::Update(const TcpProtocol &proto, Clock::time_point now)
+{
+	using namespace MsgPackProtocol;
+
+	_frame++;
+	// a WorldUpdate replaces the world state without becoming a pending message,
+	// whatever the new world does not contain anymore is removed
+	if (proto.GetWorldUpdateCount() != _worldUpdateCount)
+	{
+		_worldUpdateCount = proto.GetWorldUpdateCount();
+		removeAll(_bots, now);
+		removeAll(_food, now);
+		for (auto& bot: proto.GetBots())
+		{
+			addBot(bot);
+		}
+		for (auto& item: proto.GetFood())
+		{
+			add(_food, item.guid);
+		}
+	}
+
+	for (auto& msg: proto.GetPendingMessages())
+	{
+		switch (msg->messageType)
+		{
+			case MESSAGE_TYPE_BOT_SPAWN:
+				addBot(static_cast<const BotSpawnMessage&>(*msg).bot);
+				break;
+
+			case MESSAGE_TYPE_BOT_KILL:
+				remove(_bots, static_cast<const BotKillMessage&>(*msg).victim_id, now);
+				break;
+
+			case MESSAGE_TYPE_FOOD_SPAWN:
+				for (auto& item: static_cast<const FoodSpawnMessage&>(*msg).new_food)
+				{
+					add(_food, item.guid);
+				}
+				break;
+
+			case MESSAGE_TYPE_FOOD_CONSUME:
+				for (auto& item: static_cast<const FoodConsumeMessage&>(*msg).items)
+				{
+					remove(_food, item.food_id, now);
+				}
+				break;
+
+			case MESSAGE_TYPE_FOOD_DECAY:
+				for (auto& id: static_cast<const FoodDecayMessage&>(*msg).food_ids)
+				{
+					remove(_food, id, now);
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	expire(_bots, now);
+	expire(_food, now);
+}
+
+void CompactIds::Reset()
+{
+	_bots = Ids();
+	_food = Ids();
+	_infoIds.clear();
+	_infos.clear();
+}
+
+uint32_t CompactIds::GetInfoId(const MsgPackProtocol::BotItem &bot) const
+{
+	auto* infoId = _infoIds.find(static_cast<guid_t>(bot.database_id));
+	return infoId ? *infoId : UNKNOWN;
+}
+
+void CompactIds::addBot(const MsgPackProtocol::BotItem &bot)
+{
+	add(_bots, bot.guid);
+
+	auto result = _infoIds.insert(static_cast<guid_t>(bot.database_id), static_cast<uint32_t>(_infos.size()));
+	if (result.second)
+	{
+		_infos.push_back({ bot.database_id, bot.name, bot.face_id, bot.dog_tag_id, bot.color, _frame });
+		return;
+	}
+
+	// the bot's code can be changed between two of its lives
+	auto& info = _infos[*result.first];
+	if ((info.name != bot.name) || (info.face_id != bot.face_id) || (info.dog_tag_id != bot.dog_tag_id) || (info.color != bot.color))
+	{
+		info.name = bot.name;
+		info.face_id = bot.face_id;
+		info.dog_tag_id = bot.dog_tag_id;
+		info.color = bot.color;
+		info.changed = _frame;
+	}
+}
+
+void CompactIds::add(Ids &ids, guid_t guid)
+{
+	bool reuse = !ids.freeIds.empty();
+	uint32_t id = reuse ? ids.freeIds.back() : ids.next;
+	auto result = ids.entries.insert(guid, { guid, id, false, Clock::time_point() });
+	if (result.second)
+	{
+		if (reuse)
+		{
+			ids.freeIds.pop_back();
+		}
+		else
+		{
+			ids.next++;
+		}
+		return;
+	}
+	// still known, e.g. listed again by a WorldUpdate
+	result.first->removed = false;
+}
+
+void CompactIds::remove(Ids &ids, guid_t guid, Clock::time_point now)
+{
+	auto* entry = ids.entries.find(guid);
+	if (!entry || entry->removed) { return; }
+	entry->removed = true;
+	entry->removedAt = now;
+	ids.removals.emplace_back(guid, now);
+}
+
+void CompactIds::removeAll(Ids &ids, Clock::time_point now)
+{
+	for (auto& entry: ids.entries)
+	{
+		if (!entry.removed)
+		{
+			entry.removed = true;
+			entry.removedAt = now;
+			ids.removals.emplace_back(entry.guid, now);
+		}
+	}
+}
+
+void CompactIds::expire(Ids &ids, Clock::time_point now)
+{
+	auto retain = std::chrono::milliseconds(RETAIN_REMOVED_MS);
+	while (!ids.removals.empty() && (ids.removals.front().second + retain <= now))
+	{
+		auto* entry = ids.entries.find(ids.removals.front().first);
+		// unless it came back and was removed again later
+		if (entry && entry->removed && (entry->removedAt == ids.removals.front().second))
+		{
+			ids.freeIds.push_back(entry->id);
+			ids.entries.erase(ids.removals.front().first);
+		}
+		ids.removals.pop_front();
+	}
+}
+
+uint32_t CompactIds::getId(const Ids &ids, guid_t guid)
+{
+	auto* entry = ids.entries.find(guid);
+	return entry ? entry->id : UNKNOWN;
+}
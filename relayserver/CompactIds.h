@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "MsgPackProtocol.h"
+#include "GuidMap.h"
+
+class TcpProtocol;
+
+// ids for the compact JSON format. Bots and food are numbered by the relay,
+// each starting at 0, instead of sending 64 bit guids. Removed entities keep
+// their id for a while, so merged frames of slow rate classes can still refer
+// to them, after that the id is reused. Ids stay below the highest number of
+// entities alive (or recently removed) at the same time.
+// Name, color, face and dog tag belong to the bot's database id: they are
+// interned once per database id, and bots refer to them by info id.
+class CompactIds
+{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr const uint32_t UNKNOWN = UINT32_MAX;
+
+		struct Info
+		{
+			int database_id;
+			std::string name;
+			uint32_t face_id;
+			uint32_t dog_tag_id;
+			std::vector<uint32_t> color;
+			// frame it was added or last changed with
+			uint64_t changed;
+		};
+
+		// ingest thread, with each frame before any of its messages is encoded
+		void Update(const TcpProtocol& proto, Clock::time_point now);
+		// ids start over with a new upstream connection
+		void Reset();
+
+		// UNKNOWN for guids the relay never saw
+		uint32_t GetBotId(guid_t guid) const { return getId(_bots, guid); }
+		uint32_t GetFoodId(guid_t guid) const { return getId(_food, guid); }
+		uint32_t GetInfoId(const MsgPackProtocol::BotItem& bot) const;
+
+		size_t GetInfoCount() const { return _infos.size(); }
+		const Info& GetInfo(uint32_t infoId) const { return _infos[infoId]; }
+		// added or changed with the frame of the last Update()
+		bool IsInfoNew(uint32_t infoId) const { return _infos[infoId].changed == _frame; }
+
+	private:
+		struct Entry
+		{
+			guid_t guid;
+			uint32_t id;
+			bool removed;
+			Clock::time_point removedAt;
+		};
+
+		struct Ids
+		{
+			GuidMap<Entry> entries;
+			uint32_t next = 0;
+			// ids of expired entries, handed out again before next
+			std::vector<uint32_t> freeIds;
+			// in the order of removal
+			std::deque<std::pair<guid_t, Clock::time_point>> removals;
+		};
+
+		Ids _bots;
+		Ids _food;
+		// database id -> info id
+		GuidMap<uint32_t> _infoIds;
+		std::vector<Info> _infos;
+		uint64_t _frame = 0;
+		uint64_t _worldUpdateCount = 0;
+
+		void addBot(const MsgPackProtocol::BotItem& bot);
+		static void add(Ids& ids, guid_t guid);
+		static void remove(Ids& ids, guid_t guid, Clock::time_point now);
+		static void removeAll(Ids& ids, Clock::time_point now);
+		static void expire(Ids& ids, Clock::time_point now);
+		static uint32_t getId(const Ids& ids, guid_t guid);
+};
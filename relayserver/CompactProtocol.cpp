@@ -0,0 +1,299 @@
+#include "CompactProtocol.h"
+#include <algorithm>
+#include "TcpProtocol.h"
+
+using namespace MsgPackProtocol;
+
+namespace
+{
+	void writeId(JsonWriter& w, uint32_t id)
+	{
+		if (id == CompactIds::UNKNOWN)
+		{
+			w.nullValue();
+			return;
+		}
+		w.uintValue(id);
+	}
+
+	void writeBot(JsonWriter& w, const BotItem& bot, const CompactIds& ids)
+	{
+		w.beginObject();
+		w.key(JSON_KEY("id")); writeId(w, ids.GetBotId(bot.guid));
+		w.key(JSON_KEY("info")); writeId(w, ids.GetInfoId(bot));
+		w.key(JSON_KEY("mass")); w.doubleValue(bot.mass);
+		w.key(JSON_KEY("segment_radius")); w.doubleValue(bot.segment_radius);
+		w.key(JSON_KEY("snake_segments"));
+		w.beginArray();
+		for (auto& segment: bot.segments)
+		{
+			MsgPackProtocol::to_json(w, segment);
+		}
+		w.endArray();
+		w.endObject();
+	}
+
+	void writeFood(JsonWriter& w, const FoodItem& item, const CompactIds& ids)
+	{
+		w.beginObject();
+		w.key(JSON_KEY("id")); writeId(w, ids.GetFoodId(item.guid));
+		w.key(JSON_KEY("pos_x")); w.doubleValue(item.pos().x());
+		w.key(JSON_KEY("pos_y")); w.doubleValue(item.pos().y());
+		w.key(JSON_KEY("value")); w.doubleValue(item.value);
+		w.endObject();
+	}
+
+	void collectInfo(std::vector<uint32_t>& infoIds, const BotItem& bot, const CompactIds& ids, CompactProtocol::InfoPolicy policy)
+	{
+		uint32_t infoId = ids.GetInfoId(bot);
+		if ((infoId != CompactIds::UNKNOWN) && ((policy == CompactProtocol::INFO_ALL) || ids.IsInfoNew(infoId)))
+		{
+			infoIds.push_back(infoId);
+		}
+	}
+
+	// nothing if there are none
+	void writeInfos(JsonWriter& w, std::vector<uint32_t>& infoIds, const CompactIds& ids)
+	{
+		if (infoIds.empty()) { return; }
+		std::sort(infoIds.begin(), infoIds.end());
+		infoIds.erase(std::unique(infoIds.begin(), infoIds.end()), infoIds.end());
+
+		w.key(JSON_KEY("infos"));
+		w.beginArray();
+		for (auto infoId: infoIds)
+		{
+			auto& info = ids.GetInfo(infoId);
+			w.beginObject();
+			w.key(JSON_KEY("color"));
+			w.beginArray();
+			for (auto& color: info.color)
+			{
+				w.uintValue(color);
+			}
+			w.endArray();
+			w.key(JSON_KEY("db_id")); w.intValue(info.database_id);
+			w.key(JSON_KEY("dog_tag")); w.uintValue(info.dog_tag_id);
+			w.key(JSON_KEY("face")); w.uintValue(info.face_id);
+			w.key(JSON_KEY("id")); w.uintValue(infoId);
+			w.key(JSON_KEY("name")); w.stringValue(info.name);
+			w.endObject();
+		}
+		w.endArray();
+	}
+
+	template <class Bots, class Food>
+	void writeWorld(JsonWriter& w, const Bots& bots, const Food& food, const CompactIds& ids, std::vector<uint32_t>& infoIds)
+	{
+		w.beginObject();
+		w.key(JSON_KEY("t")); w.rawValue("\"WorldUpdate\"");
+		w.key(JSON_KEY("bots"));
+		w.beginArray();
+		for (auto& bot: bots)
+		{
+			writeBot(w, bot, ids);
+		}
+		w.endArray();
+		w.key(JSON_KEY("food"));
+		w.beginArray();
+		for (auto& item: food)
+		{
+			writeFood(w, item, ids);
+		}
+		w.endArray();
+		writeInfos(w, infoIds, ids);
+		w.endObject();
+	}
+}
+
+void CompactProtocol::to_json(JsonWriter &w, const Message &msg, const CompactIds &ids, InfoPolicy policy)
+{
+	thread_local std::vector<uint32_t> infoIds;
+	infoIds.clear();
+
+	switch (msg.messageType)
+	{
+		case MESSAGE_TYPE_WORLD_UPDATE:
+		{
+			auto& update = static_cast<const WorldUpdateMessage&>(msg);
+			for (auto& bot: update.bots)
+			{
+				collectInfo(infoIds, bot, ids, policy);
+			}
+			writeWorld(w, update.bots, update.food, ids, infoIds);
+			break;
+		}
+
+		case MESSAGE_TYPE_BOT_SPAWN:
+		{
+			auto& spawn = static_cast<const BotSpawnMessage&>(msg);
+			collectInfo(infoIds, spawn.bot, ids, policy);
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"BotSpawn\"");
+			w.key(JSON_KEY("bot")); writeBot(w, spawn.bot, ids);
+			writeInfos(w, infoIds, ids);
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_BOT_KILL:
+		{
+			auto& kill = static_cast<const BotKillMessage&>(msg);
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"BotKill\"");
+			w.key(JSON_KEY("killer_id")); writeId(w, ids.GetBotId(kill.killer_id));
+			w.key(JSON_KEY("victim_id")); writeId(w, ids.GetBotId(kill.victim_id));
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_BOT_MOVE:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"BotMove\"");
+			w.key(JSON_KEY("items"));
+			w.beginArray();
+			for (auto& item: static_cast<const BotMoveMessage&>(msg).items)
+			{
+				w.beginObject();
+				w.key(JSON_KEY("bot_id")); writeId(w, ids.GetBotId(item.bot_id));
+				w.key(JSON_KEY("length")); w.uintValue(item.current_length);
+				w.key(JSON_KEY("segment_data"));
+				w.beginArray();
+				for (auto& segment: item.new_segments)
+				{
+					MsgPackProtocol::to_json(w, segment);
+				}
+				w.endArray();
+				w.key(JSON_KEY("segment_radius")); w.doubleValue(item.current_segment_radius);
+				w.endObject();
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_BOT_STATS:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"BotStats\"");
+			w.key(JSON_KEY("data"));
+			w.beginArray();
+			for (auto& item: static_cast<const BotStatsMessage&>(msg).items)
+			{
+				w.beginObject();
+				w.key(JSON_KEY("c")); w.doubleValue(item.carrion_food_consumed);
+				w.key(JSON_KEY("h")); w.doubleValue(item.hunted_food_consumed);
+				w.key(JSON_KEY("id")); writeId(w, ids.GetBotId(item.bot_id));
+				w.key(JSON_KEY("m")); w.doubleValue(item.mass);
+				w.key(JSON_KEY("n")); w.doubleValue(item.natural_food_consumed);
+				w.endObject();
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_BOT_MOVE_HEAD:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"BotMoveHead\"");
+			w.key(JSON_KEY("items"));
+			w.beginArray();
+			for (auto& item: static_cast<const BotMoveHeadMessage&>(msg).items)
+			{
+				w.beginObject();
+				w.key(JSON_KEY("bot_id")); writeId(w, ids.GetBotId(item.bot_id));
+				w.key(JSON_KEY("m")); w.doubleValue(item.mass);
+				w.key(JSON_KEY("p"));
+				w.beginArray();
+				for (auto& pos: item.new_head_positions)
+				{
+					w.beginArray();
+					w.doubleValue(pos.x());
+					w.doubleValue(pos.y());
+					w.endArray();
+				}
+				w.endArray();
+				w.endObject();
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_SPAWN:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"FoodSpawn\"");
+			w.key(JSON_KEY("items"));
+			w.beginArray();
+			for (auto& item: static_cast<const FoodSpawnMessage&>(msg).new_food)
+			{
+				writeFood(w, item, ids);
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_CONSUME:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"FoodConsume\"");
+			w.key(JSON_KEY("items"));
+			w.beginArray();
+			for (auto& item: static_cast<const FoodConsumeMessage&>(msg).items)
+			{
+				w.beginObject();
+				w.key(JSON_KEY("bot_id")); writeId(w, ids.GetBotId(item.bot_id));
+				w.key(JSON_KEY("food_id")); writeId(w, ids.GetFoodId(item.food_id));
+				w.endObject();
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_DECAY:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"FoodDecay\"");
+			w.key(JSON_KEY("items"));
+			w.beginArray();
+			for (auto& id: static_cast<const FoodDecayMessage&>(msg).food_ids)
+			{
+				writeId(w, ids.GetFoodId(id));
+			}
+			w.endArray();
+			w.endObject();
+			break;
+		}
+
+		case MESSAGE_TYPE_PLAYER_INFO:
+		{
+			w.beginObject();
+			w.key(JSON_KEY("t")); w.rawValue("\"PlayerInfo\"");
+			w.key(JSON_KEY("player_id")); writeId(w, ids.GetBotId(static_cast<const PlayerInfoMessage&>(msg).player_id));
+			w.endObject();
+			break;
+		}
+
+		default:
+			// GameInfo and Tick have no ids
+			MsgPackProtocol::to_json(w, msg);
+			break;
+	}
+}
+
+void CompactProtocol::writeWorldUpdate(JsonWriter &w, const TcpProtocol &proto, const CompactIds &ids)
+{
+	// every info, a bot of an older one might spawn again later
+	thread_local std::vector<uint32_t> infoIds;
+	infoIds.clear();
+	for (uint32_t i=0; i<ids.GetInfoCount(); i++)
+	{
+		infoIds.push_back(i);
+	}
+	writeWorld(w, proto.GetBots(), proto.GetFood(), ids, infoIds);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "JsonProtocol.h"
+#include "CompactIds.h"
+
+class TcpProtocol;
+
+// the compact variant of the JSON format. Messages look the same, except:
+// - bot and food ids are the relay's dense ids (CompactIds), null if unknown
+// - WorldUpdate and BotStats list their items as arrays instead of objects keyed by id
+// - bots have an "info" id instead of name, color, face, dog_tag and db_id.
+//   WorldUpdate and BotSpawn carry the infos they introduce in "infos".
+namespace CompactProtocol
+{
+	typedef enum
+	{
+		// infos added or changed with the current frame, for clients that got every frame before
+		INFO_NEW,
+		// every info referred to, for frames that are not part of the full stream
+		INFO_ALL
+	} InfoPolicy;
+
+	void to_json(JsonWriter& w, const MsgPackProtocol::Message& msg, const CompactIds& ids, InfoPolicy policy);
+	// the current world state and every info known, for new connections
+	void writeWorldUpdate(JsonWriter& w, const TcpProtocol& proto, const CompactIds& ids);
+
+	// like MsgPackProtocol::writeJsonBundle(), in the compact format if ids are given
+	template <class MessageList>
+	void writeJsonBundle(MessageBundle& bundle, const MessageList& messages, const CompactIds* ids, InfoPolicy policy)
+	{
+		if (!ids)
+		{
+			MsgPackProtocol::writeJsonBundle(bundle, messages);
+			return;
+		}
+
+		bundle.clear();
+		auto& data = bundle.data;
+		data.push_back('[');
+		for (auto& msg: messages)
+		{
+			if (!bundle.items.empty())
+			{
+				data.push_back(',');
+			}
+			size_t pos = data.size();
+			JsonWriter writer(data);
+			to_json(writer, *msg, *ids, policy);
+			bundle.items.emplace_back(pos, data.size() - pos);
+			bundle.types.push_back(static_cast<uint8_t>(msg->messageType));
+		}
+		data.push_back(']');
+	}
+}
@@ -0,0 +1,98 @@
+#include "Deflater.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+	// vocabulary of the JSON protocol, most frequent strings last
+	const char DEFAULT_DICTIONARY[] =
+		"{\"food_decay_per_frame\":,\"snake_distance_per_step\":,\"snake_pull_factor\":,"
+		"\"snake_segment_distance_exponent\":,\"snake_segment_distance_factor\":,"
+		"\"world_size_x\":,\"world_size_y\":,\"t\":\"GameInfo\"}"
+		"{\"player_id\":,\"t\":\"PlayerInfo\"}"
+		"{\"bots\":[{\"color\":[],\"db_id\":,\"dog_tag\":,\"face\":,\"heading\":,\"id\":,\"mass\":,\"name\":\"\","
+		"\"segment_radius\":,\"snake_segments\":[{\"pos_x\":,\"pos_y\":}]}],\"food\":[],\"t\":\"WorldUpdate\"}"
+		"{\"bot\":{},\"t\":\"BotSpawn\"}"
+		"{\"killer_id\":,\"t\":\"BotKill\",\"victim_id\":}"
+		"{\"items\":[],\"t\":\"FoodDecay\"}"
+		"{\"items\":[{\"bot_id\":,\"food_id\":}],\"t\":\"FoodConsume\"}"
+		"{\"items\":[{\"id\":,\"pos_x\":,\"pos_y\":,\"value\":}],\"t\":\"FoodSpawn\"}"
+		"{\"frame_id\":,\"t\":\"Tick\"}"
+		"[{\"items\":[{\"bot_id\":,\"m\":,\"p\":[[,]]},{\"bot_id\":,\"m\":,\"p\":[[,]]}],\"t\":\"BotMoveHead\"}";
+
+	// empty stored block ending each message flushed with Z_SYNC_FLUSH, left out on the wire
+	const unsigned char SYNC_FLUSH_TAIL[] = { 0x00, 0x00, 0xff, 0xff };
+}
+
+Deflater::Deflater(const std::string &dictionary)
+	: _dictionary(dictionary)
+{
+	memset(&_stream, 0, sizeof(_stream));
+	// negative window bits: raw deflate without zlib header and checksum
+	if (deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		fprintf(stderr, "deflateInit2 failed\n");
+		return;
+	}
+	_initialized = true;
+}
+
+Deflater::~Deflater()
+{
+	if (_initialized)
+	{
+		deflateEnd(&_stream);
+	}
+}
+
+bool Deflater::Compress(const char *data, size_t length, std::string &out)
+{
+	if (!_initialized || (deflateReset(&_stream) != Z_OK)) { return false; }
+	if (!_dictionary.empty())
+	{
+		auto *dictionary = reinterpret_cast<const Bytef*>(_dictionary.data());
+		if (deflateSetDictionary(&_stream, dictionary, static_cast<uInt>(_dictionary.size())) != Z_OK) { return false; }
+	}
+
+	// deflateBound() does not include the sync flush marker
+	out.resize(deflateBound(&_stream, length) + 16);
+	_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	_stream.avail_in = static_cast<uInt>(length);
+	_stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	_stream.avail_out = static_cast<uInt>(out.size());
+	if ((deflate(&_stream, Z_SYNC_FLUSH) != Z_OK) || (_stream.avail_in != 0) || (_stream.avail_out == 0))
+	{
+		return false;
+	}
+
+	size_t size = out.size() - _stream.avail_out;
+	if ((size >= sizeof(SYNC_FLUSH_TAIL)) && (memcmp(&out[size - sizeof(SYNC_FLUSH_TAIL)], SYNC_FLUSH_TAIL, sizeof(SYNC_FLUSH_TAIL)) == 0))
+	{
+		size -= sizeof(SYNC_FLUSH_TAIL);
+	}
+	out.resize(size);
+	return true;
+}
+
+Deflater &Deflater::Get(bool withDictionary)
+{
+	thread_local Deflater plain("");
+	thread_local Deflater primed(GetDictionary());
+	return withDictionary ? primed : plain;
+}
+
+void Deflater::SetDictionary(const std::string &dictionary)
+{
+	sharedDictionary() = dictionary;
+}
+
+const std::string &Deflater::GetDictionary()
+{
+	return sharedDictionary();
+}
+
+std::string &Deflater::sharedDictionary()
+{
+	static std::string dictionary(DEFAULT_DICTIONARY);
+	return dictionary;
+}
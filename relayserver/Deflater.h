@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <zlib.h>
+
+// raw deflate of single websocket messages without context takeover
+// (permessage-deflate, RFC 7692), so a message compressed once can be sent
+// to every client. Optionally primed with a preset dictionary, which the
+// client needs as well to inflate the messages.
+class Deflater
+{
+	public:
+		explicit Deflater(const std::string& dictionary);
+		~Deflater();
+		Deflater(const Deflater&) = delete;
+		Deflater& operator=(const Deflater&) = delete;
+
+		// replaces out with the compressed message, false on errors
+		bool Compress(const char* data, size_t length, std::string& out);
+
+		// instance of the calling thread, with or without the preset dictionary
+		static Deflater& Get(bool withDictionary);
+		// has to be called before any thread compresses with the dictionary
+		static void SetDictionary(const std::string& dictionary);
+		static const std::string& GetDictionary();
+
+	private:
+		z_stream _stream;
+		bool _initialized = false;
+		std::string _dictionary;
+
+		static std::string& sharedDictionary();
+};
@@ -0,0 +1,226 @@
+#include "DownstreamServer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <TcpServer/EPoll.h>
+#include "TcpProtocol.h"
+#include "Metrics.h"
+
+DownstreamServer::DownstreamServer(const TcpProtocol &proto)
+	: _proto(proto)
+{
+}
+
+// the event loop might be gone already, closing the sockets removes them from it anyway
+DownstreamServer::~DownstreamServer()
+{
+	for (auto& downstream: _downstreams)
+	{
+		close(downstream.fd);
+	}
+	if (_listenSocket >= 0)
+	{
+		close(_listenSocket);
+	}
+}
+
+bool DownstreamServer::Listen(int port, EPoll &epoll)
+{
+	_listenSocket = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (_listenSocket < 0)
+	{
+		perror("downstream socket");
+		return false;
+	}
+	int enable = 1;
+	setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	struct sockaddr_in6 addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(static_cast<uint16_t>(port));
+	if ((bind(_listenSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(_listenSocket, 16) != 0))
+	{
+		perror("downstream listen");
+		close(_listenSocket);
+		_listenSocket = -1;
+		return false;
+	}
+
+	_epoll = &epoll;
+	_epoll->AddFileDescriptor(_listenSocket, EPOLLIN);
+	return true;
+}
+
+bool DownstreamServer::HandleEvent(const epoll_event &ev)
+{
+	if (ev.data.fd == _listenSocket)
+	{
+		accept();
+		return true;
+	}
+
+	size_t index = 0;
+	while ((index < _downstreams.size()) && (_downstreams[index].fd != ev.data.fd))
+	{
+		index++;
+	}
+	if (index == _downstreams.size()) { return false; }
+	auto& downstream = _downstreams[index];
+
+	if (ev.events & (EPOLLERR|EPOLLHUP|EPOLLRDHUP))
+	{
+		disconnect(index);
+		return true;
+	}
+	if (ev.events & EPOLLIN)
+	{
+		// downstream relays never send anything, so this is the connection closing
+		char discard[256];
+		ssize_t count = read(downstream.fd, discard, sizeof(discard));
+		if ((count == 0) || ((count < 0) && (errno != EAGAIN) && (errno != EINTR)))
+		{
+			disconnect(index);
+			return true;
+		}
+	}
+	if (ev.events & EPOLLOUT)
+	{
+		downstream.writable = true;
+		_epoll->DeleteFileDescriptor(downstream.fd);
+		_epoll->AddFileDescriptor(downstream.fd, EPOLLIN|EPOLLRDHUP);
+		if (!flush(downstream))
+		{
+			disconnect(index);
+		}
+	}
+	return true;
+}
+
+void DownstreamServer::Forward(const char *data, size_t size)
+{
+	for (auto& downstream: _downstreams)
+	{
+		if (downstream.synced)
+		{
+			downstream.buffer.append(data, size);
+		}
+	}
+}
+
+void DownstreamServer::FrameComplete()
+{
+	_keyframe.clear();
+	for (size_t i=_downstreams.size(); i>0; i--)
+	{
+		auto& downstream = _downstreams[i-1];
+		if (!downstream.synced)
+		{
+			// encoded at most once per frame, for all downstreams connecting in between
+			if (_keyframe.empty())
+			{
+				makeKeyframe();
+			}
+			downstream.buffer = _keyframe;
+			downstream.synced = true;
+		}
+		if (!flush(downstream))
+		{
+			disconnect(i-1);
+		}
+	}
+}
+
+void DownstreamServer::DisconnectAll()
+{
+	for (size_t i=_downstreams.size(); i>0; i--)
+	{
+		if (_downstreams[i-1].synced)
+		{
+			disconnect(i-1);
+		}
+	}
+}
+
+void DownstreamServer::accept()
+{
+	while (true)
+	{
+		int fd = accept4(_listenSocket, nullptr, nullptr, SOCK_NONBLOCK);
+		if (fd < 0)
+		{
+			if (errno == EINTR) { continue; }
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			{
+				perror("downstream accept");
+			}
+			return;
+		}
+		_epoll->AddFileDescriptor(fd, EPOLLIN|EPOLLRDHUP);
+		Downstream downstream;
+		downstream.fd = fd;
+		_downstreams.push_back(std::move(downstream));
+		Metrics::Get().downstreamConnections.fetch_add(1, std::memory_order_relaxed);
+		fprintf(stderr, "downstream relay connected\n");
+	}
+}
+
+// false if the downstream has to be disconnected
+bool DownstreamServer::flush(Downstream &downstream)
+{
+	if (!downstream.writable) { return downstream.buffer.size() <= MAX_BUFFERED_BYTES; }
+
+	size_t sent = 0;
+	while (sent < downstream.buffer.size())
+	{
+		ssize_t count = send(downstream.fd, downstream.buffer.data() + sent, downstream.buffer.size() - sent, MSG_NOSIGNAL);
+		if (count < 0)
+		{
+			if (errno == EINTR) { continue; }
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) { return false; }
+
+			// the rest is written once the socket is writable again
+			downstream.writable = false;
+			_epoll->DeleteFileDescriptor(downstream.fd);
+			_epoll->AddFileDescriptor(downstream.fd, EPOLLIN|EPOLLOUT|EPOLLRDHUP);
+			break;
+		}
+		sent += static_cast<size_t>(count);
+	}
+	downstream.buffer.erase(0, sent);
+	return downstream.buffer.size() <= MAX_BUFFERED_BYTES;
+}
+
+void DownstreamServer::disconnect(size_t index)
+{
+	int fd = _downstreams[index].fd;
+	_epoll->DeleteFileDescriptor(fd);
+	close(fd);
+	if (index + 1 < _downstreams.size())
+	{
+		_downstreams[index] = std::move(_downstreams.back());
+	}
+	_downstreams.pop_back();
+	Metrics::Get().downstreamConnections.fetch_sub(1, std::memory_order_relaxed);
+	fprintf(stderr, "downstream relay disconnected\n");
+}
+
+void DownstreamServer::makeKeyframe()
+{
+	msgpack::sbuffer gameInfo;
+	MsgPackProtocol::pack(gameInfo, _proto.GetGameInfo());
+	msgpack::sbuffer worldUpdate;
+	_proto.PackWorldUpdate(worldUpdate);
+
+	for (auto* buf: { &gameInfo, &worldUpdate })
+	{
+		uint32_t length = htonl(static_cast<uint32_t>(buf->size()));
+		_keyframe.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		_keyframe.append(buf->data(), buf->size());
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+
+class EPoll;
+class TcpProtocol;
+
+// serves the upstream stream of one room to other relays, which connect to it
+// like to a gameserver. The messages are forwarded exactly as received, length
+// prefix included. A new downstream first gets the current state as GameInfo
+// and WorldUpdate at the end of a frame, and the stream from the next frame on.
+// Everything runs on the ingest thread.
+class DownstreamServer
+{
+	public:
+		// a downstream with more bytes queued is disconnected, it reconnects and starts over
+		static constexpr const size_t MAX_BUFFERED_BYTES = 64*1024*1024;
+
+		explicit DownstreamServer(const TcpProtocol& proto);
+		~DownstreamServer();
+		DownstreamServer(const DownstreamServer&) = delete;
+		DownstreamServer& operator=(const DownstreamServer&) = delete;
+
+		bool Listen(int port, EPoll& epoll);
+		// false if the event is not for one of this server's sockets
+		bool HandleEvent(const epoll_event& ev);
+		// raw message callback of the room's TcpProtocol
+		void Forward(const char* data, size_t size);
+		// syncs new downstreams and writes the frame to all of them
+		void FrameComplete();
+		// the upstream connection was lost, the downstreams reconnect and get the new state
+		void DisconnectAll();
+		size_t GetConnectionCount() const { return _downstreams.size(); }
+
+	private:
+		struct Downstream
+		{
+			int fd;
+			bool synced = false;
+			bool writable = true;
+			std::string buffer;
+		};
+
+		const TcpProtocol& _proto;
+		EPoll* _epoll = nullptr;
+		int _listenSocket = -1;
+		std::vector<Downstream> _downstreams;
+		std::string _keyframe;
+
+		void accept();
+		bool flush(Downstream& downstream);
+		void disconnect(size_t index);
+		void makeKeyframe();
+};
@@ -0,0 +1,90 @@
+#include "FanoutWorker.h"
+
+FanoutWorker::FanoutWorker(SetupCallback setupCallback, FrameCallback frameCallback)
+	: _setupCallback(setupCallback), _frameCallback(frameCallback), _queue(QUEUE_SIZE)
+{
+}
+
+FanoutWorker::~FanoutWorker()
+{
+	Stop();
+}
+
+bool FanoutWorker::Start(int port, int extensionOptions)
+{
+	std::promise<bool> listening;
+	auto result = listening.get_future();
+	_thread = std::thread(&FanoutWorker::run, this, port, extensionOptions, std::move(listening));
+	if (!result.get())
+	{
+		_thread.join();
+		return false;
+	}
+	return true;
+}
+
+void FanoutWorker::Stop()
+{
+	if (!_thread.joinable()) { return; }
+	_stopping = true;
+	_async->send();
+	_thread.join();
+}
+
+void FanoutWorker::Publish(std::shared_ptr<const FrameData> frame)
+{
+	if (!_queue.push(std::move(frame)))
+	{
+		_droppedFrames++;
+		_overflow = true;
+	}
+	_async->send();
+}
+
+void FanoutWorker::run(int port, int extensionOptions, std::promise<bool> listening)
+{
+	uWS::Hub hub(extensionOptions);
+	_hub = &hub;
+	_setupCallback(*this, hub);
+
+	// closes (and deletes) itself on stop
+	_async = new uS::Async(hub.getLoop());
+	_async->setData(this);
+	_async->start(&FanoutWorker::onAsync);
+
+	if (!hub.listen(port, nullptr, uS::REUSE_PORT))
+	{
+		_async->close();
+		listening.set_value(false);
+		return;
+	}
+	listening.set_value(true);
+
+	hub.run();
+	_hub = nullptr;
+}
+
+void FanoutWorker::onAsync(uS::Async *async)
+{
+	static_cast<FanoutWorker*>(async->getData())->processFrames();
+}
+
+void FanoutWorker::processFrames()
+{
+	if (_stopping)
+	{
+		_hub->getDefaultGroup<uWS::SERVER>().close();
+		for (auto* group: _groups)
+		{
+			group->close();
+		}
+		_async->close();
+		return;
+	}
+
+	std::shared_ptr<const FrameData> frame;
+	while (_queue.pop(frame))
+	{
+		_frameCallback(*this, _hub->getDefaultGroup<uWS::SERVER>(), *frame, _overflow.exchange(false));
+	}
+}
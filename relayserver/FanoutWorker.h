@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <uWS.h>
+#include "FrameData.h"
+#include "SpscQueue.h"
+
+// thread with its own uWS::Hub, serving the connections the kernel hands to it
+// (all workers listen on the same port with SO_REUSEPORT). The ingest thread
+// publishes each frame to every worker through a lock-free queue and wakes the
+// worker's event loop up; the frame data itself is shared, not copied.
+class FanoutWorker
+{
+	public:
+		typedef std::function<void(FanoutWorker& worker, uWS::Hub& hub)> SetupCallback;
+		// resync: frames were dropped, all connections need a new snapshot
+		typedef std::function<void(FanoutWorker& worker, uWS::Group<uWS::SERVER>& group, const FrameData& frame, bool resync)> FrameCallback;
+		static constexpr const size_t QUEUE_SIZE = 64;
+
+		FanoutWorker(SetupCallback setupCallback, FrameCallback frameCallback);
+		~FanoutWorker();
+		FanoutWorker(const FanoutWorker&) = delete;
+		FanoutWorker& operator=(const FanoutWorker&) = delete;
+
+		// starts the thread, returns once the hub listens on port (or failed to)
+		bool Start(int port, int extensionOptions = uWS::NO_OPTIONS);
+		void Stop();
+
+		// ingest thread only, a frame that does not fit into the queue is dropped
+		void Publish(std::shared_ptr<const FrameData> frame);
+		// setup callback only, a group of the hub that is closed on stop, besides the default group
+		void AddGroup(uWS::Group<uWS::SERVER>* group) { _groups.push_back(group); }
+		uint64_t GetDroppedFrames() const { return _droppedFrames; }
+
+	private:
+		SetupCallback _setupCallback;
+		FrameCallback _frameCallback;
+		SpscQueue<std::shared_ptr<const FrameData>> _queue;
+		std::thread _thread;
+		uWS::Hub* _hub = nullptr;
+		uS::Async* _async = nullptr;
+		std::vector<uWS::Group<uWS::SERVER>*> _groups;
+		std::atomic<bool> _overflow{false};
+		std::atomic<bool> _stopping{false};
+		std::atomic<uint64_t> _droppedFrames{0};
+
+		void run(int port, int extensionOptions, std::promise<bool> listening);
+		void processFrames();
+		static void onAsync(uS::Async* async);
+};
@@ -0,0 +1,216 @@
+#include "FrameCoalescer.h"
+#include "JsonProtocol.h"
+#include "CompactProtocol.h"
+
+namespace
+{
+	constexpr const double RATES[FrameCoalescer::RATE_CLASS_COUNT] = { 30, 20, 10, 5, 2, 1 };
+	// upstream frames arrive with some jitter, a frame this close to the due time is not held back
+	constexpr const int DUE_TOLERANCE_DIVISOR = 4;
+}
+
+double FrameCoalescer::GetRate(size_t rateClass)
+{
+	return RATES[rateClass];
+}
+
+int FrameCoalescer::SelectRateClass(double maxRate)
+{
+	if (!(maxRate > 0) || (maxRate > RATES[0])) { return -1; }
+	for (size_t i=0; i<RATE_CLASS_COUNT; i++)
+	{
+		if (RATES[i] <= maxRate) { return static_cast<int>(i); }
+	}
+	return static_cast<int>(RATE_CLASS_COUNT - 1);
+}
+
+FrameCoalescer::FrameCoalescer(double rate)
+	: _interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate)))
+{
+}
+
+bool FrameCoalescer::AddFrame(const std::vector<const MsgPackProtocol::Message*> &messages, Subscription::Mask subscriptions, Clock::time_point now)
+{
+	for (auto& msg: messages)
+	{
+		merge(*msg);
+	}
+
+	if (!_started)
+	{
+		_started = true;
+		_nextDue = now + _interval;
+		return false;
+	}
+	if (now + _interval / DUE_TOLERANCE_DIVISOR < _nextDue) { return false; }
+
+	_nextDue += _interval;
+	if (_nextDue <= now)
+	{
+		// after a stall, don't catch up with a burst of updates
+		_nextDue = now + _interval;
+	}
+	encode(subscriptions);
+	clear();
+	return true;
+}
+
+void FrameCoalescer::Reset()
+{
+	clear();
+	_started = false;
+}
+
+void FrameCoalescer::merge(const MsgPackProtocol::Message &msg)
+{
+	switch (msg.messageType)
+	{
+		case MsgPackProtocol::MESSAGE_TYPE_TICK:
+			_tick = std::make_unique<MsgPackProtocol::TickMessage>(static_cast<const MsgPackProtocol::TickMessage&>(msg));
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_SPAWN:
+		{
+			auto& bot = static_cast<const MsgPackProtocol::BotSpawnMessage&>(msg).bot;
+			_spawnedBots.erase(bot.guid);
+			_spawnedBots.insert(bot.guid, bot);
+			break;
+		}
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_KILL:
+			mergeKill(static_cast<const MsgPackProtocol::BotKillMessage&>(msg));
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD:
+			for (auto& item: static_cast<const MsgPackProtocol::BotMoveHeadMessage&>(msg).items)
+			{
+				auto result = _heads.insert(item.bot_id, item);
+				if (result.second) { continue; }
+				auto& merged = *result.first;
+				merged.mass = item.mass;
+				merged.new_head_positions.insert(merged.new_head_positions.end(), item.new_head_positions.begin(), item.new_head_positions.end());
+			}
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_STATS:
+			_stats = std::make_unique<MsgPackProtocol::BotStatsMessage>(static_cast<const MsgPackProtocol::BotStatsMessage&>(msg));
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_SPAWN:
+			for (auto& item: static_cast<const MsgPackProtocol::FoodSpawnMessage&>(msg).new_food)
+			{
+				_food.erase(item.guid);
+				_food.insert(item.guid, { FOOD_SPAWNED, item, 0 });
+			}
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_CONSUME:
+			for (auto& item: static_cast<const MsgPackProtocol::FoodConsumeMessage&>(msg).items)
+			{
+				mergeFoodRemoval(item.food_id, FOOD_CONSUMED, item.bot_id);
+			}
+			break;
+
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_DECAY:
+			for (auto food_id: static_cast<const MsgPackProtocol::FoodDecayMessage&>(msg).food_ids)
+			{
+				mergeFoodRemoval(food_id, FOOD_DECAYED, 0);
+			}
+			break;
+
+		default:
+			// not forwarded to clients as messages
+			break;
+	}
+}
+
+void FrameCoalescer::mergeKill(const MsgPackProtocol::BotKillMessage &msg)
+{
+	_heads.erase(msg.victim_id);
+	// the client never saw a bot spawned since the last update
+	if (!_spawnedBots.erase(msg.victim_id))
+	{
+		_kills.push_back(msg);
+	}
+}
+
+void FrameCoalescer::mergeFoodRemoval(guid_t food_id, FoodChange change, guid_t bot_id)
+{
+	auto* state = _food.find(food_id);
+	if (state && (state->change == FOOD_SPAWNED))
+	{
+		_food.erase(food_id);
+		return;
+	}
+	FoodState removed;
+	removed.change = change;
+	removed.item.guid = food_id;
+	removed.bot_id = bot_id;
+	_food.insert(food_id, removed);
+}
+
+void FrameCoalescer::encode(Subscription::Mask subscriptions)
+{
+	using namespace MsgPackProtocol;
+	// types nobody in the class subscribed to are left out
+	auto subscribed = [subscriptions](uint64_t messageType) {
+		return (Subscription::GetBit(messageType) & subscriptions) != 0;
+	};
+
+	_merged.clear();
+	if (subscribed(MESSAGE_TYPE_BOT_SPAWN))
+	{
+		for (auto& bot: _spawnedBots)
+		{
+			auto msg = std::make_unique<BotSpawnMessage>();
+			msg->bot = bot;
+			_merged.push_back(std::move(msg));
+		}
+	}
+	if (!_heads.empty() && subscribed(MESSAGE_TYPE_BOT_MOVE_HEAD))
+	{
+		auto msg = std::make_unique<BotMoveHeadMessage>();
+		msg->items.assign(_heads.begin(), _heads.end());
+		_merged.push_back(std::move(msg));
+	}
+	if (subscribed(MESSAGE_TYPE_BOT_KILL))
+	{
+		for (auto& kill: _kills)
+		{
+			_merged.push_back(std::make_unique<BotKillMessage>(kill));
+		}
+	}
+
+	auto spawn = std::make_unique<FoodSpawnMessage>();
+	auto consume = std::make_unique<FoodConsumeMessage>();
+	auto decay = std::make_unique<FoodDecayMessage>();
+	for (auto& state: _food)
+	{
+		switch (state.change)
+		{
+			case FOOD_SPAWNED: spawn->new_food.push_back(state.item); break;
+			case FOOD_CONSUMED: consume->items.push_back({ state.item.guid, state.bot_id }); break;
+			case FOOD_DECAYED: decay->food_ids.push_back(state.item.guid); break;
+		}
+	}
+	if (!spawn->new_food.empty() && subscribed(MESSAGE_TYPE_FOOD_SPAWN)) { _merged.push_back(std::move(spawn)); }
+	if (!consume->items.empty() && subscribed(MESSAGE_TYPE_FOOD_CONSUME)) { _merged.push_back(std::move(consume)); }
+	if (!decay->food_ids.empty() && subscribed(MESSAGE_TYPE_FOOD_DECAY)) { _merged.push_back(std::move(decay)); }
+
+	if (_stats && subscribed(MESSAGE_TYPE_BOT_STATS)) { _merged.push_back(std::move(_stats)); }
+	if (_tick) { _merged.push_back(std::move(_tick)); }
+
+	// the clients skipped the frames that introduced the infos of spawned bots
+	CompactProtocol::writeJsonBundle(_json, _merged, _compactIds, CompactProtocol::INFO_ALL);
+	MsgPackProtocol::packBundle(_msgpack, _merged);
+}
+
+void FrameCoalescer::clear()
+{
+	_spawnedBots.clear();
+	_heads.clear();
+	_kills.clear();
+	_food.clear();
+	_stats.reset();
+	_tick.reset();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "MsgPackProtocol.h"
+#include "MessageBundle.h"
+#include "GuidMap.h"
+#include "CompactIds.h"
+#include "Subscription.h"
+
+// merges the frames between two updates of a rate limited client into one:
+// head positions of each bot are concatenated, food spawned and removed in
+// between is left out entirely, as are bots spawned and killed in between,
+// and only the last BotStats and Tick are kept. The merged frame is encoded
+// once for all clients of the same rate class.
+class FrameCoalescer
+{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		// maximum update rates clients can choose from, in Hz, fastest first
+		static constexpr const size_t RATE_CLASS_COUNT = 6;
+		static double GetRate(size_t rateClass);
+		// the fastest class not above maxRate (the slowest one for lower rates),
+		// -1 if the client wants every frame
+		static int SelectRateClass(double maxRate);
+
+		explicit FrameCoalescer(double rate);
+
+		// merges the pending messages of a frame, true if the merged frame is due with it.
+		// Everything is merged, but a due frame only contains the types in subscriptions.
+		bool AddFrame(const std::vector<const MsgPackProtocol::Message*>& messages, Subscription::Mask subscriptions, Clock::time_point now);
+		// the merged frame, only valid after AddFrame() returned true and until its next call
+		const MessageBundle& GetJson() const { return _json; }
+		const MessageBundle& GetMsgPack() const { return _msgpack; }
+		// forgets everything merged so far and starts over with the next frame
+		void Reset();
+		// JSON in the compact format, nullptr for the regular one
+		void SetCompactIds(const CompactIds* ids) { _compactIds = ids; }
+
+	private:
+		typedef enum
+		{
+			FOOD_SPAWNED,
+			FOOD_CONSUMED,
+			FOOD_DECAYED
+		} FoodChange;
+
+		struct FoodState
+		{
+			FoodChange change;
+			MsgPackProtocol::FoodItem item;
+			guid_t bot_id;
+		};
+
+		Clock::duration _interval;
+		bool _started = false;
+		Clock::time_point _nextDue;
+
+		GuidMap<MsgPackProtocol::BotItem> _spawnedBots;
+		GuidMap<MsgPackProtocol::BotMoveHeadItem> _heads;
+		std::vector<MsgPackProtocol::BotKillMessage> _kills;
+		GuidMap<FoodState> _food;
+		std::unique_ptr<MsgPackProtocol::BotStatsMessage> _stats;
+		std::unique_ptr<MsgPackProtocol::TickMessage> _tick;
+
+		std::vector<std::unique_ptr<MsgPackProtocol::Message>> _merged;
+		MessageBundle _json;
+		MessageBundle _msgpack;
+		const CompactIds* _compactIds = nullptr;
+
+		void merge(const MsgPackProtocol::Message& msg);
+		void mergeKill(const MsgPackProtocol::BotKillMessage& msg);
+		void mergeFoodRemoval(guid_t food_id, FoodChange change, guid_t bot_id);
+		void encode(Subscription::Mask subscriptions);
+		void clear();
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include "MessageBundle.h"
+#include "TcpProtocol.h"
+#include "SnapshotCache.h"
+#include "FrameCoalescer.h"
+#include "StatsCache.h"
+
+// everything the connections need of one frame, encoded by the ingest thread
+// and shared read-only by all fan-out workers
+struct FrameData
+{
+	// index of the room the frame belongs to
+	size_t room = 0;
+	uint64_t frame_id = 0;
+	MessageBundle json;
+	MessageBundle msgpack;
+	TcpProtocol::LogItemMap logItems;
+	// first frame of a new upstream connection, every connection starts over with the snapshot
+	bool resync = false;
+
+	// GameInfo and WorldUpdate for new connections, only present if a worker asked for it
+	bool hasSnapshot = false;
+	MessageBundle snapshots[SnapshotCache::FORMAT_COUNT];
+
+	// merged frames of the rate classes that are due with this frame
+	bool rateClassDue[FrameCoalescer::RATE_CLASS_COUNT] = {};
+	MessageBundle rateClassJson[FrameCoalescer::RATE_CLASS_COUNT];
+	MessageBundle rateClassMsgPack[FrameCoalescer::RATE_CLASS_COUNT];
+
+	// for the streaming /stats subscribers, only present if the stats changed with this frame
+	std::shared_ptr<const StatsCache::Responses> stats;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "types.h"
+
+// guid -> T map storing all items in one contiguous vector. Lookups go
+// through an open addressing index (linear probing, backward shift deletion),
+// erase swaps the last item into the gap, so iteration is a linear scan.
+// Pointers and iterators are invalidated by insert() and erase().
+template <class T>
+class GuidMap
+{
+	public:
+		typedef typename std::vector<T>::iterator iterator;
+		typedef typename std::vector<T>::const_iterator const_iterator;
+
+		GuidMap() { rehash(MIN_CAPACITY); }
+
+		size_t size() const { return _items.size(); }
+		bool empty() const { return _items.empty(); }
+		iterator begin() { return _items.begin(); }
+		iterator end() { return _items.end(); }
+		const_iterator begin() const { return _items.begin(); }
+		const_iterator end() const { return _items.end(); }
+
+		T* find(guid_t id)
+		{
+			size_t slot = findSlot(id);
+			return (_slots[slot].index == EMPTY) ? nullptr : &_items[_slots[slot].index];
+		}
+
+		const T* find(guid_t id) const
+		{
+			return const_cast<GuidMap*>(this)->find(id);
+		}
+
+		// like std::map::insert(), an existing item with the same id is kept
+		std::pair<T*, bool> insert(guid_t id, const T& item)
+		{
+			size_t slot = findSlot(id);
+			if (_slots[slot].index != EMPTY)
+			{
+				return std::make_pair(&_items[_slots[slot].index], false);
+			}
+
+			if ((_items.size() + 1) * 2 > _slots.size())
+			{
+				rehash(_slots.size() * 2);
+				slot = findSlot(id);
+			}
+
+			_slots[slot] = { id, static_cast<uint32_t>(_items.size()) };
+			_keys.push_back(id);
+			_items.push_back(item);
+			return std::make_pair(&_items.back(), true);
+		}
+
+		bool erase(guid_t id)
+		{
+			size_t slot = findSlot(id);
+			uint32_t index = _slots[slot].index;
+			if (index == EMPTY) { return false; }
+			removeSlot(slot);
+
+			uint32_t last = static_cast<uint32_t>(_items.size() - 1);
+			if (index != last)
+			{
+				_items[index] = std::move(_items[last]);
+				_keys[index] = _keys[last];
+				_slots[findSlot(_keys[index])].index = index;
+			}
+			_items.pop_back();
+			_keys.pop_back();
+			return true;
+		}
+
+		void clear()
+		{
+			_items.clear();
+			_keys.clear();
+			for (auto& slot: _slots)
+			{
+				slot.index = EMPTY;
+			}
+		}
+
+		void reserve(size_t count)
+		{
+			_items.reserve(count);
+			_keys.reserve(count);
+			size_t capacity = _slots.size();
+			while (count * 2 > capacity)
+			{
+				capacity *= 2;
+			}
+			if (capacity != _slots.size())
+			{
+				rehash(capacity);
+			}
+		}
+
+	private:
+		static constexpr const uint32_t EMPTY = UINT32_MAX;
+		static constexpr const size_t MIN_CAPACITY = 64;
+
+		struct Slot
+		{
+			guid_t id;
+			uint32_t index;
+		};
+
+		std::vector<Slot> _slots;
+		std::vector<guid_t> _keys;
+		std::vector<T> _items;
+		size_t _mask = 0;
+
+		size_t home(guid_t id) const
+		{
+			// fibonacci hashing, guids are often sequential
+			return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> 32) & _mask;
+		}
+
+		// slot holding id, or the empty slot where it would be inserted
+		size_t findSlot(guid_t id) const
+		{
+			size_t slot = home(id);
+			while ((_slots[slot].index != EMPTY) && (_slots[slot].id != id))
+			{
+				slot = (slot + 1) & _mask;
+			}
+			return slot;
+		}
+
+		void removeSlot(size_t slot)
+		{
+			size_t next = slot;
+			while (true)
+			{
+				next = (next + 1) & _mask;
+				if (_slots[next].index == EMPTY) { break; }
+
+				// move entries back that would not be found anymore across the gap
+				size_t wanted = home(_slots[next].id);
+				if (((next - wanted) & _mask) >= ((next - slot) & _mask))
+				{
+					_slots[slot] = _slots[next];
+					slot = next;
+				}
+			}
+			_slots[slot].index = EMPTY;
+		}
+
+		void rehash(size_t capacity)
+		{
+			_slots.assign(capacity, { 0, EMPTY });
+			_mask = capacity - 1;
+			for (uint32_t i=0; i<_keys.size(); i++)
+			{
+				_slots[findSlot(_keys[i])] = { _keys[i], i };
+			}
+		}
+};
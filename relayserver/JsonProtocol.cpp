@@ -92,7 +92,7 @@ void MsgPackProtocol::to_json(nlohmann::json &j, const MsgPackProtocol::BotItem
 		{"color", item.color},
 		{"mass", item.mass},
 		{"segment_radius", item.segment_radius},
-		{"snake_segments", item.segments},
+		{"snake_segments", json(std::vector<SnakeSegmentItem>(item.segments.begin(), item.segments.end()))},
 		{"heading", 0}
 	};
 }
@@ -238,3 +238,276 @@ void MsgPackProtocol::to_json(nlohmann::json &j, const MsgPackProtocol::PlayerIn
 		{"player_id", msg.player_id}
 	};
 }
+
+/* Streaming encoders
+ *
+ * nlohmann::json stores objects in a std::map, so keys are written in
+ * lexicographic order here to keep the output byte-identical.
+ */
+
+namespace
+{
+	template <class Container>
+	void writeArray(JsonWriter& w, const Container& items)
+	{
+		w.beginArray();
+		for (auto& item: items)
+		{
+			MsgPackProtocol::to_json(w, item);
+		}
+		w.endArray();
+	}
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::Message &msg)
+{
+	switch (msg.messageType)
+	{
+		case MESSAGE_TYPE_GAME_INFO:
+			to_json(w, *static_cast<const GameInfoMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_WORLD_UPDATE:
+			to_json(w, *static_cast<const WorldUpdateMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_TICK:
+			to_json(w, *static_cast<const TickMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_SPAWN:
+			to_json(w, *static_cast<const BotSpawnMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_KILL:
+			to_json(w, *static_cast<const BotKillMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_MOVE:
+			to_json(w, *static_cast<const BotMoveMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_STATS:
+			to_json(w, *static_cast<const BotStatsMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_MOVE_HEAD:
+			to_json(w, *static_cast<const BotMoveHeadMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_BOT_LOG:
+			// log items are delivered per viewer, never as a message of their own
+			w.nullValue();
+			break;
+		case MESSAGE_TYPE_FOOD_SPAWN:
+			to_json(w, *static_cast<const FoodSpawnMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_FOOD_CONSUME:
+			to_json(w, *static_cast<const FoodConsumeMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_FOOD_DECAY:
+			to_json(w, *static_cast<const FoodDecayMessage*>(&msg));
+			break;
+		case MESSAGE_TYPE_PLAYER_INFO:
+			to_json(w, *static_cast<const PlayerInfoMessage*>(&msg));
+			break;
+	}
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::GameInfoMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("food_decay_per_frame")); w.doubleValue(msg.food_decay_per_frame);
+	w.key(JSON_KEY("snake_distance_per_step")); w.doubleValue(msg.snake_distance_per_step);
+	w.key(JSON_KEY("snake_pull_factor")); w.doubleValue(msg.snake_pull_factor);
+	w.key(JSON_KEY("snake_segment_distance_exponent")); w.doubleValue(msg.snake_segment_distance_exponent);
+	w.key(JSON_KEY("snake_segment_distance_factor")); w.doubleValue(msg.snake_segment_distance_factor);
+	w.key(JSON_KEY("t")); w.rawValue("\"GameInfo\"");
+	w.key(JSON_KEY("world_size_x")); w.doubleValue(msg.world_size_x);
+	w.key(JSON_KEY("world_size_y")); w.doubleValue(msg.world_size_y);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::WorldUpdateMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("bots"));
+	w.idObject(msg.bots,
+		[](const BotItem& bot) { return bot.guid; },
+		[&w](const BotItem& bot) { to_json(w, bot); }
+	);
+	w.key(JSON_KEY("food"));
+	w.idObject(msg.food,
+		[](const FoodItem& item) { return item.guid; },
+		[&w](const FoodItem& item) { to_json(w, item); }
+	);
+	w.key(JSON_KEY("t")); w.rawValue("\"WorldUpdate\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("color"));
+	w.beginArray();
+	for (auto& color: item.color)
+	{
+		w.uintValue(color);
+	}
+	w.endArray();
+	w.key(JSON_KEY("db_id")); w.intValue(item.database_id);
+	w.key(JSON_KEY("dog_tag")); w.uintValue(item.dog_tag_id);
+	w.key(JSON_KEY("face")); w.uintValue(item.face_id);
+	w.key(JSON_KEY("heading")); w.rawValue("0");
+	w.key(JSON_KEY("id")); w.uintValue(item.guid);
+	w.key(JSON_KEY("mass")); w.doubleValue(item.mass);
+	w.key(JSON_KEY("name")); w.stringValue(item.name);
+	w.key(JSON_KEY("segment_radius")); w.doubleValue(item.segment_radius);
+	w.key(JSON_KEY("snake_segments")); writeArray(w, item.segments);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::SnakeSegmentItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("pos_x")); w.doubleValue(item.pos().x());
+	w.key(JSON_KEY("pos_y")); w.doubleValue(item.pos().y());
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::FoodItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("id")); w.uintValue(item.guid);
+	w.key(JSON_KEY("pos_x")); w.doubleValue(item.pos().x());
+	w.key(JSON_KEY("pos_y")); w.doubleValue(item.pos().y());
+	w.key(JSON_KEY("value")); w.doubleValue(item.value);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::TickMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("frame_id")); w.uintValue(msg.frame_id);
+	w.key(JSON_KEY("t")); w.rawValue("\"Tick\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotSpawnMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("bot")); to_json(w, msg.bot);
+	w.key(JSON_KEY("t")); w.rawValue("\"BotSpawn\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotKillMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("killer_id")); w.uintValue(msg.killer_id);
+	w.key(JSON_KEY("t")); w.rawValue("\"BotKill\"");
+	w.key(JSON_KEY("victim_id")); w.uintValue(msg.victim_id);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotMoveMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("items")); writeArray(w, msg.items);
+	w.key(JSON_KEY("t")); w.rawValue("\"BotMove\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotMoveItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("bot_id")); w.uintValue(item.bot_id);
+	w.key(JSON_KEY("length")); w.uintValue(item.current_length);
+	w.key(JSON_KEY("segment_data")); writeArray(w, item.new_segments);
+	w.key(JSON_KEY("segment_radius")); w.doubleValue(item.current_segment_radius);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotStatsMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("data"));
+	w.idObject(msg.items,
+		[](const BotStatsItem& item) { return item.bot_id; },
+		[&w](const BotStatsItem& item)
+		{
+			w.beginObject();
+			w.key(JSON_KEY("c")); w.doubleValue(item.carrion_food_consumed);
+			w.key(JSON_KEY("h")); w.doubleValue(item.hunted_food_consumed);
+			w.key(JSON_KEY("m")); w.doubleValue(item.mass);
+			w.key(JSON_KEY("n")); w.doubleValue(item.natural_food_consumed);
+			w.endObject();
+		}
+	);
+	w.key(JSON_KEY("t")); w.rawValue("\"BotStats\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotMoveHeadMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("items")); writeArray(w, msg.items);
+	w.key(JSON_KEY("t")); w.rawValue("\"BotMoveHead\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::BotMoveHeadItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("bot_id")); w.uintValue(item.bot_id);
+	w.key(JSON_KEY("m")); w.doubleValue(item.mass);
+	w.key(JSON_KEY("p"));
+	w.beginArray();
+	for (auto& pos: item.new_head_positions)
+	{
+		w.beginArray();
+		w.doubleValue(pos.x());
+		w.doubleValue(pos.y());
+		w.endArray();
+	}
+	w.endArray();
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::FoodSpawnMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("items")); writeArray(w, msg.new_food);
+	w.key(JSON_KEY("t")); w.rawValue("\"FoodSpawn\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::FoodConsumeMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("items")); writeArray(w, msg.items);
+	w.key(JSON_KEY("t")); w.rawValue("\"FoodConsume\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::FoodConsumeItem &item)
+{
+	w.beginObject();
+	w.key(JSON_KEY("bot_id")); w.uintValue(item.bot_id);
+	w.key(JSON_KEY("food_id")); w.uintValue(item.food_id);
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::FoodDecayMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("items"));
+	w.beginArray();
+	for (auto& id: msg.food_ids)
+	{
+		w.uintValue(id);
+	}
+	w.endArray();
+	w.key(JSON_KEY("t")); w.rawValue("\"FoodDecay\"");
+	w.endObject();
+}
+
+void MsgPackProtocol::to_json(JsonWriter &w, const MsgPackProtocol::PlayerInfoMessage &msg)
+{
+	w.beginObject();
+	w.key(JSON_KEY("player_id")); w.uintValue(msg.player_id);
+	w.key(JSON_KEY("t")); w.rawValue("\"PlayerInfo\"");
+	w.endObject();
+}
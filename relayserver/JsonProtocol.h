@@ -1,6 +1,7 @@
 #pragma once
 
 #include "MsgPackProtocol.h"
+#include "JsonWriter.h"
 #include <nlohmann/json.hpp>
 using nlohmann::json;
 
@@ -26,4 +27,48 @@ namespace MsgPackProtocol
 	void to_json(json& j, const FoodConsumeItem& item);
 	void to_json(json& j, const FoodDecayMessage& msg);
 	void to_json(json& j, const PlayerInfoMessage& msg);
+
+	// streaming variants of the above, producing the same bytes as json(msg).dump()
+	void to_json(JsonWriter& w, const Message& msg);
+
+	void to_json(JsonWriter& w, const GameInfoMessage& msg);
+	void to_json(JsonWriter& w, const WorldUpdateMessage& msg);
+	void to_json(JsonWriter& w, const BotItem& item);
+	void to_json(JsonWriter& w, const SnakeSegmentItem& item);
+	void to_json(JsonWriter& w, const FoodItem& item);
+	void to_json(JsonWriter& w, const TickMessage& msg);
+	void to_json(JsonWriter& w, const BotSpawnMessage& msg);
+	void to_json(JsonWriter& w, const BotKillMessage& msg);
+	void to_json(JsonWriter& w, const BotMoveMessage& msg);
+	void to_json(JsonWriter& w, const BotMoveItem& item);
+	void to_json(JsonWriter& w, const BotStatsMessage& msg);
+	void to_json(JsonWriter& w, const BotMoveHeadMessage& msg);
+	void to_json(JsonWriter& w, const BotMoveHeadItem& item);
+	void to_json(JsonWriter& w, const FoodSpawnMessage& msg);
+	void to_json(JsonWriter& w, const FoodConsumeMessage& msg);
+	void to_json(JsonWriter& w, const FoodConsumeItem& item);
+	void to_json(JsonWriter& w, const FoodDecayMessage& msg);
+	void to_json(JsonWriter& w, const PlayerInfoMessage& msg);
+
+	// encodes all messages as one JSON array, recording where each message is within it
+	template <class MessageList>
+	void writeJsonBundle(MessageBundle& bundle, const MessageList& messages)
+	{
+		bundle.clear();
+		auto& data = bundle.data;
+		data.push_back('[');
+		for (auto& msg: messages)
+		{
+			if (!bundle.items.empty())
+			{
+				data.push_back(',');
+			}
+			size_t pos = data.size();
+			JsonWriter writer(data);
+			to_json(writer, *msg);
+			bundle.items.emplace_back(pos, data.size() - pos);
+			bundle.types.push_back(static_cast<uint8_t>(msg->messageType));
+		}
+		data.push_back(']');
+	}
 }
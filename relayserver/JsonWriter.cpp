@@ -0,0 +1,124 @@
+#include "JsonWriter.h"
+#include <cmath>
+#include <nlohmann/json.hpp>
+
+void JsonWriter::key(uint64_t id)
+{
+	separate();
+	_buf.push_back('"');
+	appendUInt(id);
+	_buf.append("\":", 2);
+	_needSeparator = false;
+}
+
+void JsonWriter::key(const IdKey &id)
+{
+	separate();
+	_buf.push_back('"');
+	_buf.append(id.digits, id.length);
+	_buf.append("\":", 2);
+	_needSeparator = false;
+}
+
+void JsonWriter::rawValue(const char *data, size_t length)
+{
+	separate();
+	_buf.append(data, length);
+	_needSeparator = true;
+}
+
+void JsonWriter::uintValue(uint64_t value)
+{
+	separate();
+	appendUInt(value);
+	_needSeparator = true;
+}
+
+void JsonWriter::intValue(int64_t value)
+{
+	separate();
+	if (value < 0)
+	{
+		_buf.push_back('-');
+		appendUInt(0 - static_cast<uint64_t>(value));
+	}
+	else
+	{
+		appendUInt(static_cast<uint64_t>(value));
+	}
+	_needSeparator = true;
+}
+
+void JsonWriter::doubleValue(double value)
+{
+	if (!std::isfinite(value))
+	{
+		rawValue("null");
+		return;
+	}
+
+	separate();
+	char buf[64];
+	char* end = nlohmann::detail::to_chars(buf, buf + sizeof(buf), value);
+	_buf.append(buf, static_cast<size_t>(end - buf));
+	_needSeparator = true;
+}
+
+void JsonWriter::stringValue(const std::string &value)
+{
+	static const char* HEX = "0123456789abcdef";
+
+	separate();
+	_buf.push_back('"');
+	for (char c: value)
+	{
+		switch (c)
+		{
+			case '"': _buf.append("\\\"", 2); break;
+			case '\\': _buf.append("\\\\", 2); break;
+			case '\b': _buf.append("\\b", 2); break;
+			case '\f': _buf.append("\\f", 2); break;
+			case '\n': _buf.append("\\n", 2); break;
+			case '\r': _buf.append("\\r", 2); break;
+			case '\t': _buf.append("\\t", 2); break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					const char escaped[6] = { '\\', 'u', '0', '0', HEX[(c >> 4) & 0x0F], HEX[c & 0x0F] };
+					_buf.append(escaped, sizeof(escaped));
+				}
+				else
+				{
+					_buf.push_back(c);
+				}
+				break;
+		}
+	}
+	_buf.push_back('"');
+	_needSeparator = true;
+}
+
+void JsonWriter::appendUInt(uint64_t value)
+{
+	char buf[20];
+	char* p = buf + sizeof(buf);
+	do
+	{
+		*--p = static_cast<char>('0' + (value % 10));
+		value /= 10;
+	} while (value != 0);
+	_buf.append(p, static_cast<size_t>(buf + sizeof(buf) - p));
+}
+
+JsonWriter::IdKey::IdKey(uint64_t id, size_t index)
+	: index(index)
+{
+	char* p = digits + sizeof(digits);
+	do
+	{
+		*--p = static_cast<char>('0' + (id % 10));
+		id /= 10;
+	} while (id != 0);
+	length = static_cast<uint8_t>(digits + sizeof(digits) - p);
+	memmove(digits, p, length);
+}
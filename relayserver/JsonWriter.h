@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// pre-escaped object key, including quotes and colon
+#define JSON_KEY(name) "\"" name "\":"
+
+// streaming JSON encoder appending directly to a (reused) byte buffer,
+// formatting numbers and strings exactly like nlohmann::json::dump()
+class JsonWriter
+{
+	public:
+		JsonWriter(std::string& buf) : _buf(buf) {}
+
+		void beginObject() { separate(); _buf.push_back('{'); _needSeparator = false; }
+		void endObject() { _buf.push_back('}'); _needSeparator = true; }
+		void beginArray() { separate(); _buf.push_back('['); _needSeparator = false; }
+		void endArray() { _buf.push_back(']'); _needSeparator = true; }
+
+		template <size_t N> void key(const char (&escapedKey)[N])
+		{
+			separate();
+			_buf.append(escapedKey, N-1);
+			_needSeparator = false;
+		}
+		void key(uint64_t id);
+
+		template <size_t N> void rawValue(const char (&raw)[N])
+		{
+			separate();
+			_buf.append(raw, N-1);
+			_needSeparator = true;
+		}
+		void rawValue(const char* data, size_t length);
+		void nullValue() { rawValue("null"); }
+		void uintValue(uint64_t value);
+		void intValue(int64_t value);
+		void doubleValue(double value);
+		void stringValue(const std::string& value);
+
+		// writes items as an object keyed by their decimal id. nlohmann::json keeps
+		// objects in a std::map, so keys are written in lexicographic order and
+		// for duplicate ids the last item wins, like json::operator[]
+		template <class Container, class GetId, class WriteItem>
+		void idObject(const Container& items, GetId getId, WriteItem writeItem)
+		{
+			typedef typename std::decay<decltype(*std::begin(items))>::type Item;
+			thread_local std::vector<std::pair<IdKey, const Item*>> keys;
+
+			keys.clear();
+			for (auto& item: items)
+			{
+				keys.emplace_back(IdKey(getId(item), keys.size()), &item);
+			}
+			std::sort(keys.begin(), keys.end(),
+				[](const std::pair<IdKey, const Item*>& a, const std::pair<IdKey, const Item*>& b) { return a.first < b.first; }
+			);
+
+			beginObject();
+			for (size_t i=0; i<keys.size(); i++)
+			{
+				if ((i+1 < keys.size()) && keys[i].first.sameId(keys[i+1].first))
+				{
+					continue;
+				}
+				key(keys[i].first);
+				writeItem(*keys[i].second);
+			}
+			endObject();
+		}
+
+	private:
+		struct IdKey
+		{
+			char digits[20];
+			uint8_t length;
+			size_t index;
+
+			IdKey(uint64_t id, size_t index);
+			bool sameId(const IdKey& other) const
+			{
+				return (length == other.length) && (memcmp(digits, other.digits, length) == 0);
+			}
+			bool operator<(const IdKey& other) const
+			{
+				int cmp = memcmp(digits, other.digits, std::min(length, other.length));
+				if (cmp != 0) { return cmp < 0; }
+				if (length != other.length) { return length < other.length; }
+				return index < other.index;
+			}
+		};
+
+		std::string& _buf;
+		bool _needSeparator = false;
+
+		void separate() { if (_needSeparator) { _buf.push_back(','); } }
+		void appendUInt(uint64_t value);
+		void key(const IdKey& id);
+};
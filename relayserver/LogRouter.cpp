@@ -0,0 +1,60 @@
+#include "LogRouter.h"
+#include <algorithm>
+#include "JsonWriter.h"
+#include "WebsocketConnection.h"
+
+void LogRouter::Add(uint64_t viewerKey, WebsocketConnection *con)
+{
+	if (viewerKey == 0) { return; }
+	auto* connections = _connections.insert(viewerKey, std::vector<WebsocketConnection*>()).first;
+	connections->push_back(con);
+}
+
+void LogRouter::Remove(uint64_t viewerKey, WebsocketConnection *con)
+{
+	auto* connections = _connections.find(viewerKey);
+	if (!connections) { return; }
+	connections->erase(std::remove(connections->begin(), connections->end(), con), connections->end());
+	if (connections->empty())
+	{
+		_connections.erase(viewerKey);
+	}
+}
+
+void LogRouter::Deliver(uint64_t frame_id, const TcpProtocol::LogItemMap &logItems)
+{
+	for (auto& kvp: logItems)
+	{
+		auto* connections = _connections.find(kvp.first);
+		if (!connections || kvp.second.empty()) { continue; }
+
+		writeLogBundle(_bundle, frame_id, kvp.second);
+		for (auto* con: *connections)
+		{
+			con->sendLogs(_bundle);
+		}
+	}
+}
+
+// same layout as the tick bundles: a JSON array of Log messages, with the offset of each one
+void LogRouter::writeLogBundle(MessageBundle &bundle, uint64_t frame_id, const std::vector<MsgPackProtocol::BotLogItem> &items)
+{
+	bundle.clear();
+	bundle.data.push_back('[');
+	for (auto& item: items)
+	{
+		if (!bundle.items.empty())
+		{
+			bundle.data.push_back(',');
+		}
+		size_t start = bundle.data.size();
+		JsonWriter writer(bundle.data);
+		writer.beginObject();
+		writer.key(JSON_KEY("frame")); writer.uintValue(frame_id);
+		writer.key(JSON_KEY("msg")); writer.stringValue(item.message);
+		writer.key(JSON_KEY("t")); writer.rawValue("\"Log\"");
+		writer.endObject();
+		bundle.items.emplace_back(start, bundle.data.size() - start);
+	}
+	bundle.data.push_back(']');
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "GuidMap.h"
+#include "MessageBundle.h"
+#include "TcpProtocol.h"
+
+class WebsocketConnection;
+
+// viewer_key -> connections of one hub, so bot log messages reach their
+// owners without looking at every socket. Connections register themselves
+// when they get a viewer key and unregister when they are deleted.
+class LogRouter
+{
+	public:
+		// viewer key 0 means none and is not routed
+		void Add(uint64_t viewerKey, WebsocketConnection* con);
+		void Remove(uint64_t viewerKey, WebsocketConnection* con);
+		// encodes each viewer's log items of the frame once and sends them to all its connections
+		void Deliver(uint64_t frame_id, const TcpProtocol::LogItemMap& logItems);
+
+	private:
+		GuidMap<std::vector<WebsocketConnection*>> _connections;
+		MessageBundle _bundle;
+
+		static void writeLogBundle(MessageBundle& bundle, uint64_t frame_id, const std::vector<MsgPackProtocol::BotLogItem>& items);
+};
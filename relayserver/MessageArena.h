@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "MsgPackProtocol.h"
+
+// the messages of one upstream frame. Handlers decode into messages taken
+// from here instead of allocating them, and the whole frame is released with
+// one Reset() after the frame callback. Messages are recycled instead of
+// freed and keep the capacity of their item vectors, so once a frame of
+// similar size was seen, a frame's messages need no allocation.
+class MessageArena
+{
+	public:
+		// an empty message, valid until the next Reset()
+		template <class T>
+		T& Make()
+		{
+			auto& pool = std::get<Pool<T>>(_pools);
+			if (pool.used == pool.messages.size())
+			{
+				pool.messages.push_back(std::make_unique<T>());
+			}
+			T& msg = *pool.messages[pool.used++];
+			recycle(msg);
+			return msg;
+		}
+
+		void Reset()
+		{
+			resetPools(std::integral_constant<size_t, 0>());
+		}
+
+	private:
+		template <class T>
+		struct Pool
+		{
+			std::vector<std::unique_ptr<T>> messages;
+			size_t used = 0;
+		};
+
+		std::tuple<
+			Pool<MsgPackProtocol::TickMessage>,
+			Pool<MsgPackProtocol::BotSpawnMessage>,
+			Pool<MsgPackProtocol::BotKillMessage>,
+			Pool<MsgPackProtocol::BotLogMessage>,
+			Pool<MsgPackProtocol::BotStatsMessage>,
+			Pool<MsgPackProtocol::BotMoveHeadMessage>,
+			Pool<MsgPackProtocol::FoodSpawnMessage>,
+			Pool<MsgPackProtocol::FoodConsumeMessage>,
+			Pool<MsgPackProtocol::FoodDecayMessage>
+		> _pools;
+
+		static constexpr const size_t POOL_COUNT = std::tuple_size<decltype(_pools)>::value;
+
+		template <size_t I>
+		void resetPools(std::integral_constant<size_t, I>)
+		{
+			std::get<I>(_pools).used = 0;
+			resetPools(std::integral_constant<size_t, I+1>());
+		}
+		void resetPools(std::integral_constant<size_t, POOL_COUNT>) {}
+
+		// everything else is overwritten by the decoder
+		template <class T> static void recycle(T&) {}
+		static void recycle(MsgPackProtocol::BotLogMessage& msg) { msg.items.clear(); }
+		static void recycle(MsgPackProtocol::BotStatsMessage& msg) { msg.items.clear(); }
+		static void recycle(MsgPackProtocol::FoodSpawnMessage& msg) { msg.new_food.clear(); }
+		static void recycle(MsgPackProtocol::FoodConsumeMessage& msg) { msg.items.clear(); }
+		static void recycle(MsgPackProtocol::FoodDecayMessage& msg) { msg.food_ids.clear(); }
+		// the items are kept with their head position vectors, BotMoveHeadVisitor reuses them
+};
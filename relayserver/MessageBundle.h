@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// encoded messages of one frame, stored back to back in a single buffer
+struct MessageBundle
+{
+	std::string data;
+	// offset and length of each message within data
+	std::vector<std::pair<size_t, size_t>> items;
+	// MsgPackProtocol::MessageType of each item, empty if the encoder did not record them
+	std::vector<uint8_t> types;
+
+	void clear()
+	{
+		data.clear();
+		items.clear();
+		types.clear();
+	}
+};
@@ -0,0 +1,138 @@
+#include "Metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include "MsgPackProtocol.h"
+
+namespace
+{
+	constexpr const double NS_TO_SECONDS = 1e-9;
+
+	void append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+	void append(std::string& out, const char* format, ...)
+	{
+		char line[256];
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		if (length > 0)
+		{
+			out.append(line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+		}
+	}
+
+	void writeHeader(std::string& out, const char* name, const char* help, const char* type)
+	{
+		append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	}
+
+	void writeCounter(std::string& out, const char* name, const char* help, uint64_t value)
+	{
+		writeHeader(out, name, help, "counter");
+		append(out, "%s %llu\n", name, static_cast<unsigned long long>(value));
+	}
+}
+
+void Histogram::Add(const Counts &counts)
+{
+	for (size_t i=0; i<BUCKET_COUNT; i++)
+	{
+		if (counts.buckets[i] > 0)
+		{
+			_buckets[i].fetch_add(counts.buckets[i], std::memory_order_relaxed);
+		}
+	}
+	_sum.fetch_add(counts.sum, std::memory_order_relaxed);
+}
+
+void Histogram::Write(std::string &out, const char *name, const char *help, double scale) const
+{
+	writeHeader(out, name, help, "histogram");
+	uint64_t count = 0;
+	for (size_t i=0; i<BUCKET_COUNT; i++)
+	{
+		count += _buckets[i].load(std::memory_order_relaxed);
+		if (i+1 < BUCKET_COUNT)
+		{
+			append(out, "%s_bucket{le=\"%g\"} %llu\n", name, static_cast<double>(1ULL << i) * scale, static_cast<unsigned long long>(count));
+		}
+		else
+		{
+			append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, static_cast<unsigned long long>(count));
+		}
+	}
+	append(out, "%s_sum %.17g\n", name, static_cast<double>(_sum.load(std::memory_order_relaxed)) * scale);
+	append(out, "%s_count %llu\n", name, static_cast<unsigned long long>(count));
+}
+
+Metrics& Metrics::Get()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+uint64_t Metrics::NowNs()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Metrics::RecordUpstreamMessage(uint64_t message_type, size_t bytes, uint64_t decodeNs)
+{
+	auto& counters = _upstream[std::min<uint64_t>(message_type, MESSAGE_TYPE_COUNT - 1)];
+	add(counters.messages, 1);
+	add(counters.bytes, bytes);
+	add(counters.decodeNs, decodeNs);
+}
+
+void Metrics::Write(std::string &out) const
+{
+	struct
+	{
+		const char* name;
+		const char* help;
+		std::atomic<uint64_t> MessageCounters::*field;
+		double scale;
+	} upstreamMetrics[] = {
+		{ "relay_upstream_messages_total", "Messages received from the gameserver.", &MessageCounters::messages, 1 },
+		{ "relay_upstream_bytes_total", "Bytes received from the gameserver, including length prefixes.", &MessageCounters::bytes, 1 },
+		{ "relay_decode_seconds_total", "Time spent decoding upstream messages and updating the world state.", &MessageCounters::decodeNs, NS_TO_SECONDS },
+	};
+	for (auto& metric: upstreamMetrics)
+	{
+		writeHeader(out, metric.name, metric.help, "counter");
+		for (size_t type=0; type<MESSAGE_TYPE_COUNT; type++)
+		{
+			auto& counters = _upstream[type];
+			if (counters.messages.load(std::memory_order_relaxed) == 0) { continue; }
+
+			const char* typeName = MsgPackProtocol::messageTypeName(type);
+			std::string label = typeName ? typeName : std::to_string(type);
+			uint64_t value = (counters.*metric.field).load(std::memory_order_relaxed);
+			if (metric.scale == 1)
+			{
+				append(out, "%s{type=\"%s\"} %llu\n", metric.name, label.c_str(), static_cast<unsigned long long>(value));
+			}
+			else
+			{
+				append(out, "%s{type=\"%s\"} %.9f\n", metric.name, label.c_str(), static_cast<double>(value) * metric.scale);
+			}
+		}
+	}
+
+	frameCallbackNs.Write(out, "relay_frame_callback_seconds", "Encoding and broadcasting or publishing a frame on the ingest thread.", NS_TO_SECONDS);
+	workerFrameNs.Write(out, "relay_worker_frame_seconds", "Broadcasting a published frame on a fan-out thread.", NS_TO_SECONDS);
+	frameJsonBytes.Write(out, "relay_frame_json_bytes", "Size of the JSON encoding of a frame.", 1);
+	sendQueueBytes.Write(out, "relay_send_queue_bytes", "Bytes queued for a client at the start of a frame.", 1);
+	eventLoopLagNs.Write(out, "relay_event_loop_lag_seconds", "Time to handle one batch of events on the ingest thread.", NS_TO_SECONDS);
+
+	writeHeader(out, "relay_connected_clients", "Connected websocket clients.", "gauge");
+	append(out, "relay_connected_clients %lld\n", static_cast<long long>(connectedClients.load(std::memory_order_relaxed)));
+	writeCounter(out, "relay_frames_skipped_total", "Frames not sent to clients that are too far behind.", framesSkipped.load(std::memory_order_relaxed));
+	writeCounter(out, "relay_clients_resynced_total", "Snapshots sent again to clients after skipped or dropped frames.", clientsResynced.load(std::memory_order_relaxed));
+	writeCounter(out, "relay_clients_disconnected_total", "Clients disconnected for being too slow.", clientsDisconnected.load(std::memory_order_relaxed));
+	writeHeader(out, "relay_downstream_connections", "Connected downstream relays.", "gauge");
+	append(out, "relay_downstream_connections %lld\n", static_cast<long long>(downstreamConnections.load(std::memory_order_relaxed)));
+}
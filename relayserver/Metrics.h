@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <string>
+
+// lock-free histogram with power of two buckets: bucket i counts the values
+// up to 2^i, the last one everything larger
+class Histogram
+{
+	public:
+		static constexpr const size_t BUCKET_COUNT = 36;
+
+		// plain counts to aggregate many observations within one thread, see Add()
+		struct Counts
+		{
+			std::array<uint64_t, BUCKET_COUNT> buckets{};
+			uint64_t sum = 0;
+
+			void Observe(uint64_t value) { buckets[BucketIndex(value)]++; sum += value; }
+		};
+
+		void Observe(uint64_t value)
+		{
+			_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+			_sum.fetch_add(value, std::memory_order_relaxed);
+		}
+		void Add(const Counts& counts);
+		// Prometheus text format, with bucket bounds and sum multiplied by scale
+		void Write(std::string& out, const char* name, const char* help, double scale) const;
+
+		static size_t BucketIndex(uint64_t value)
+		{
+			if (value <= 1) { return 0; }
+			size_t index = static_cast<size_t>(64 - __builtin_clzll(value - 1));
+			return (index < BUCKET_COUNT) ? index : BUCKET_COUNT - 1;
+		}
+
+	private:
+		std::array<std::atomic<uint64_t>, BUCKET_COUNT> _buckets{};
+		std::atomic<uint64_t> _sum{0};
+};
+
+// relay health, served as /metrics. Everything recorded on the hot paths is a
+// relaxed atomic, without locks or allocations, so it is always enabled.
+class Metrics
+{
+	public:
+		static constexpr const size_t MESSAGE_TYPE_COUNT = 256;
+
+		struct MessageCounters
+		{
+			std::atomic<uint64_t> messages{0};
+			std::atomic<uint64_t> bytes{0};
+			std::atomic<uint64_t> decodeNs{0};
+		};
+
+		static Metrics& Get();
+		static uint64_t NowNs();
+
+		// ingest thread only: upstream message including its length prefix, decoding and state update time
+		void RecordUpstreamMessage(uint64_t message_type, size_t bytes, uint64_t decodeNs);
+		void Write(std::string& out) const;
+
+		// ingest thread: the frame complete callback, encoding and broadcasting (or publishing) a frame
+		Histogram frameCallbackNs;
+		// fan-out threads: broadcasting a published frame
+		Histogram workerFrameNs;
+		// the JSON encoding of a frame shared by all clients
+		Histogram frameJsonBytes;
+		// bytes queued per client at the start of each frame
+		Histogram sendQueueBytes;
+		// ingest thread: handling one batch of events, the longest a new event waits
+		Histogram eventLoopLagNs;
+
+		std::atomic<int64_t> connectedClients{0};
+		std::atomic<uint64_t> framesSkipped{0};
+		std::atomic<uint64_t> clientsResynced{0};
+		std::atomic<uint64_t> clientsDisconnected{0};
+		// relays fed by this one, see DownstreamServer
+		std::atomic<int64_t> downstreamConnections{0};
+
+	private:
+		std::array<MessageCounters, MESSAGE_TYPE_COUNT> _upstream;
+
+		// the ingest thread is the only writer, so no atomic read-modify-write is needed
+		static void add(std::atomic<uint64_t>& counter, uint64_t value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+};
@@ -45,3 +45,24 @@ void MsgPackProtocol::pack(msgpack::sbuffer &buf, const Message &msg)
 			break;
 	}
 }
+
+const char* MsgPackProtocol::messageTypeName(uint64_t message_type)
+{
+	switch (message_type)
+	{
+		case MESSAGE_TYPE_GAME_INFO: return "GameInfo";
+		case MESSAGE_TYPE_WORLD_UPDATE: return "WorldUpdate";
+		case MESSAGE_TYPE_TICK: return "Tick";
+		case MESSAGE_TYPE_BOT_SPAWN: return "BotSpawn";
+		case MESSAGE_TYPE_BOT_KILL: return "BotKill";
+		case MESSAGE_TYPE_BOT_MOVE: return "BotMove";
+		case MESSAGE_TYPE_BOT_LOG: return "BotLog";
+		case MESSAGE_TYPE_BOT_STATS: return "BotStats";
+		case MESSAGE_TYPE_BOT_MOVE_HEAD: return "BotMoveHead";
+		case MESSAGE_TYPE_FOOD_SPAWN: return "FoodSpawn";
+		case MESSAGE_TYPE_FOOD_CONSUME: return "FoodConsume";
+		case MESSAGE_TYPE_FOOD_DECAY: return "FoodDecay";
+		case MESSAGE_TYPE_PLAYER_INFO: return "PlayerInfo";
+	}
+	return nullptr;
+}
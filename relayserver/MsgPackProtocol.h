@@ -3,6 +3,8 @@
 #include <vector>
 #include <msgpack.hpp>
 #include "types.h"
+#include "RingBuffer.h"
+#include "MessageBundle.h"
 
 namespace MsgPackProtocol
 {
@@ -56,7 +58,7 @@ namespace MsgPackProtocol
 
 		real_t mass;
 		real_t segment_radius;
-		std::vector<SnakeSegmentItem> segments;
+		RingBuffer<SnakeSegmentItem> segments; // head first
 	};
 
 	struct BotLogItem
@@ -190,12 +192,64 @@ namespace MsgPackProtocol
 	};
 
 	void pack(msgpack::sbuffer& buf, const Message& msg);
+	// readable name of a message type, nullptr for unknown types
+	const char* messageTypeName(uint64_t message_type);
+
+	// packs all messages back to back, recording where each message is within the bundle
+	template <class MessageList>
+	void packBundle(MessageBundle& bundle, const MessageList& messages)
+	{
+		msgpack::sbuffer buf;
+		bundle.clear();
+		for (auto& msg: messages)
+		{
+			size_t pos = buf.size();
+			pack(buf, *msg);
+			bundle.items.emplace_back(pos, buf.size() - pos);
+			bundle.types.push_back(static_cast<uint8_t>(msg->messageType));
+		}
+		bundle.data.assign(buf.data(), buf.size());
+	}
 }
 
 namespace msgpack {
 	MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
 		namespace adaptor {
 
+			template <typename T> struct pack<RingBuffer<T>>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, RingBuffer<T> const& v) const
+				{
+					o.pack_array(static_cast<uint32_t>(v.size()));
+					for (int n=0; n<2; n++)
+					{
+						auto span = v.span(n);
+						for (size_t i=0; i<span.size; i++)
+						{
+							o.pack(span.data[i]);
+						}
+					}
+					return o;
+				}
+			};
+
+			template <typename T> struct convert<RingBuffer<T>>
+			{
+				msgpack::object const& operator()(msgpack::object const& o, RingBuffer<T>& v) const
+				{
+					if (o.type != msgpack::type::ARRAY) throw msgpack::type_error();
+					v.clear();
+					v.reserve(o.via.array.size);
+					for (uint32_t i=0; i<o.via.array.size; i++)
+					{
+						T item;
+						o.via.array.ptr[i] >> item;
+						v.push_back(item);
+					}
+					return o;
+				}
+			};
+
 			template <> struct pack<MsgPackProtocol::GameInfoMessage>
 			{
 				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::GameInfoMessage const& v) const
@@ -0,0 +1,279 @@
+#include "MsgPackVisitors.h"
+
+namespace
+{
+	bool readUInt(const uint8_t* data, size_t count, size_t& pos, uint64_t& value)
+	{
+		if (pos >= count) { return false; }
+		uint8_t marker = data[pos++];
+		size_t length;
+		if (marker <= 0x7f) { value = marker; return true; }
+		else if (marker == 0xcc) { length = 1; }
+		else if (marker == 0xcd) { length = 2; }
+		else if (marker == 0xce) { length = 4; }
+		else if (marker == 0xcf) { length = 8; }
+		else { return false; }
+
+		if (pos + length > count) { return false; }
+		value = 0;
+		for (size_t i=0; i<length; i++)
+		{
+			value = (value << 8) | data[pos++];
+		}
+		return true;
+	}
+
+	bool readArrayHeader(const uint8_t* data, size_t count, size_t& pos, uint64_t& size)
+	{
+		if (pos >= count) { return false; }
+		uint8_t marker = data[pos++];
+		size_t length;
+		if ((marker & 0xf0) == 0x90) { size = marker & 0x0f; return true; }
+		else if (marker == 0xdc) { length = 2; }
+		else if (marker == 0xdd) { length = 4; }
+		else { return false; }
+
+		if (pos + length > count) { return false; }
+		size = 0;
+		for (size_t i=0; i<length; i++)
+		{
+			size = (size << 8) | data[pos++];
+		}
+		return true;
+	}
+}
+
+bool MsgPackVisitors::PeekMessageType(const char *data, size_t count, uint64_t &message_type)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(data);
+	size_t pos = 0;
+	uint64_t size, version;
+	return readArrayHeader(bytes, count, pos, size) && (size >= 2)
+		&& readUInt(bytes, count, pos, version) && readUInt(bytes, count, pos, message_type);
+}
+
+bool MsgPackVisitors::ReadTick(const char *data, size_t count, uint64_t &frame_id)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(data);
+	size_t pos = 0;
+	uint64_t size, version, message_type;
+	return readArrayHeader(bytes, count, pos, size) && (size == 3)
+		&& readUInt(bytes, count, pos, version) && readUInt(bytes, count, pos, message_type)
+		&& readUInt(bytes, count, pos, frame_id) && (pos == count);
+}
+
+// [version, type, [[bot_id, [[x, y], ...], current_length, current_segment_radius], ...]]
+
+MsgPackVisitors::BotMoveVisitor::BotMoveVisitor(std::vector<BotMoveUpdate> &updates, std::vector<MsgPackProtocol::SnakeSegmentItem> &segments)
+	: _updates(updates), _segments(segments)
+{
+	_updates.clear();
+	_segments.clear();
+}
+
+bool MsgPackVisitors::BotMoveVisitor::onArrayStart(uint32_t size)
+{
+	switch (_depth)
+	{
+		case 1: _updates.reserve(size); return true;
+		case 2:
+			if (size != 4) { return false; }
+			_updates.push_back({ 0, 0, 0, _segments.size(), 0 });
+			return true;
+		case 3:
+			if (index(2) != 1) { return false; }
+			_segments.reserve(_segments.size() + size);
+			return true;
+		case 4:
+			if (size != 2) { return false; }
+			_segments.push_back({ _updates.back().bot_id, { 0, 0 } });
+			return true;
+	}
+	return false;
+}
+
+bool MsgPackVisitors::BotMoveVisitor::onArrayEnd()
+{
+	if (_depth == 3)
+	{
+		auto& update = _updates.back();
+		update.segmentCount = _segments.size() - update.firstSegment;
+	}
+	return true;
+}
+
+bool MsgPackVisitors::BotMoveVisitor::onValue(const Number &n)
+{
+	if (_depth == 2)
+	{
+		auto& update = _updates.back();
+		switch (index(2))
+		{
+			case 0:
+				if (!n.isUInt) { return false; }
+				update.bot_id = n.u;
+				return true;
+			case 2:
+				if (!n.isUInt) { return false; }
+				update.length = n.u;
+				return true;
+			case 3:
+				update.radius = static_cast<real_t>(n.d);
+				return true;
+		}
+		return false;
+	}
+	if (_depth == 4)
+	{
+		_segments.back().position[index(4)] = static_cast<real_t>(n.d);
+		return true;
+	}
+	return false;
+}
+
+// [version, type, [[bot_id, mass, [[x, y], ...]], ...]]
+
+MsgPackVisitors::BotMoveHeadVisitor::BotMoveHeadVisitor(MsgPackProtocol::BotMoveHeadMessage &msg)
+	: _msg(msg)
+{
+}
+
+// the items of a recycled message are overwritten, so their position vectors keep their capacity
+bool MsgPackVisitors::BotMoveHeadVisitor::onArrayStart(uint32_t size)
+{
+	switch (_depth)
+	{
+		case 1: _msg.items.resize(size); return true;
+		case 2:
+			if (size != 3) { return false; }
+			_msg.items[index(1)].new_head_positions.clear();
+			return true;
+		case 3:
+			if (index(2) != 2) { return false; }
+			_msg.items[index(1)].new_head_positions.reserve(size);
+			return true;
+		case 4:
+			if (size != 2) { return false; }
+			_msg.items[index(1)].new_head_positions.emplace_back(0, 0);
+			return true;
+	}
+	return false;
+}
+
+bool MsgPackVisitors::BotMoveHeadVisitor::onValue(const Number &n)
+{
+	if (_depth == 2)
+	{
+		auto& item = _msg.items[index(1)];
+		switch (index(2))
+		{
+			case 0:
+				if (!n.isUInt) { return false; }
+				item.bot_id = n.u;
+				return true;
+			case 1:
+				item.mass = n.d;
+				return true;
+		}
+		return false;
+	}
+	if (_depth == 4)
+	{
+		_msg.items[index(1)].new_head_positions.back()[index(4)] = static_cast<real_t>(n.d);
+		return true;
+	}
+	return false;
+}
+
+// [version, type, [[guid, x, y, value], ...]]
+
+MsgPackVisitors::FoodSpawnVisitor::FoodSpawnVisitor(MsgPackProtocol::FoodSpawnMessage &msg)
+	: _msg(msg)
+{
+}
+
+bool MsgPackVisitors::FoodSpawnVisitor::onArrayStart(uint32_t size)
+{
+	switch (_depth)
+	{
+		case 1: _msg.new_food.reserve(size); return true;
+		case 2:
+			if (size != 4) { return false; }
+			_msg.new_food.push_back({ 0, { 0, 0 }, 0 });
+			return true;
+	}
+	return false;
+}
+
+bool MsgPackVisitors::FoodSpawnVisitor::onValue(const Number &n)
+{
+	if (_depth != 2) { return false; }
+	auto& item = _msg.new_food.back();
+	switch (index(2))
+	{
+		case 0:
+			if (!n.isUInt) { return false; }
+			item.guid = n.u;
+			break;
+		case 1: item.position.x() = static_cast<real_t>(n.d); break;
+		case 2: item.position.y() = static_cast<real_t>(n.d); break;
+		case 3: item.value = static_cast<real_t>(n.d); break;
+	}
+	return true;
+}
+
+// [version, type, [[food_id, bot_id], ...]]
+
+MsgPackVisitors::FoodConsumeVisitor::FoodConsumeVisitor(MsgPackProtocol::FoodConsumeMessage &msg)
+	: _msg(msg)
+{
+}
+
+bool MsgPackVisitors::FoodConsumeVisitor::onArrayStart(uint32_t size)
+{
+	switch (_depth)
+	{
+		case 1: _msg.items.reserve(size); return true;
+		case 2:
+			if (size != 2) { return false; }
+			_msg.items.push_back({ 0, 0 });
+			return true;
+	}
+	return false;
+}
+
+bool MsgPackVisitors::FoodConsumeVisitor::onValue(const Number &n)
+{
+	if ((_depth != 2) || !n.isUInt) { return false; }
+	auto& item = _msg.items.back();
+	if (index(2) == 0)
+	{
+		item.food_id = n.u;
+	}
+	else
+	{
+		item.bot_id = n.u;
+	}
+	return true;
+}
+
+// [version, type, [food_id, ...]]
+
+MsgPackVisitors::FoodDecayVisitor::FoodDecayVisitor(MsgPackProtocol::FoodDecayMessage &msg)
+	: _msg(msg)
+{
+}
+
+bool MsgPackVisitors::FoodDecayVisitor::onArrayStart(uint32_t size)
+{
+	if (_depth != 1) { return false; }
+	_msg.food_ids.reserve(size);
+	return true;
+}
+
+bool MsgPackVisitors::FoodDecayVisitor::onValue(const Number &n)
+{
+	if ((_depth != 1) || !n.isUInt) { return false; }
+	_msg.food_ids.push_back(n.u);
+	return true;
+}
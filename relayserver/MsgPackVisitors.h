@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <msgpack.hpp>
+#include "MsgPackProtocol.h"
+
+/* SAX style decoders for the high-volume upstream messages.
+ *
+ * They are driven by msgpack::v2::parse() directly on the receive buffer, so
+ * no msgpack::object tree (and no zone allocation) is built for these
+ * messages. Visitors only decode and validate, the world state is changed by
+ * the caller once the whole message was parsed successfully.
+ */
+namespace MsgPackVisitors
+{
+	// reads [version, message_type, ...] without decoding the rest of the message
+	bool PeekMessageType(const char* data, size_t count, uint64_t& message_type);
+	// reads a whole [version, type, frame_id] Tick message
+	bool ReadTick(const char* data, size_t count, uint64_t& frame_id);
+
+	template <class Visitor> bool Parse(const char* data, size_t count, Visitor& visitor)
+	{
+		size_t offset = 0;
+		visitor.setMessageSize(count);
+		return msgpack::v2::parse(data, count, offset, visitor) == msgpack::PARSE_SUCCESS;
+	}
+
+	// a number as it was encoded, integer ids are only valid if isUInt is set
+	struct Number
+	{
+		double d;
+		bool isUInt;
+		uint64_t u;
+	};
+
+	// tracks the position within nested arrays and forwards all numbers as
+	// onValue(const Number&); Derived may implement onArrayStart/onArrayEnd.
+	// depth 0 is the message array itself, it has to be [version, type, items].
+	// Anything but arrays and numbers fails the parse.
+	template <class Derived>
+	class ArrayVisitor : public msgpack::v2::null_visitor
+	{
+		public:
+			// every array item takes at least a byte, larger sizes are not reserved for
+			void setMessageSize(size_t count) { _messageSize = count; }
+
+			bool start_array(uint32_t size)
+			{
+				if ((++_depth >= MAX_DEPTH) || (size > _messageSize)) { return false; }
+				_index[_depth] = 0;
+				if (_depth == 0) { return size == 3; }
+				// the items are the last element of the message
+				if ((_depth == 1) && (index(0) != 2)) { return false; }
+				return derived().onArrayStart(size);
+			}
+			bool end_array_item()
+			{
+				_index[_depth]++;
+				return true;
+			}
+			bool end_array()
+			{
+				bool result = derived().onArrayEnd();
+				_depth--;
+				return result;
+			}
+			bool visit_positive_integer(uint64_t v) { return value({ static_cast<double>(v), true, v }); }
+			bool visit_negative_integer(int64_t v) { return value({ static_cast<double>(v), false, 0 }); }
+			bool visit_float32(float v) { return value({ v, false, 0 }); }
+			bool visit_float64(double v) { return value({ v, false, 0 }); }
+			bool visit_nil() { return false; }
+			bool visit_boolean(bool) { return false; }
+			bool visit_str(const char*, uint32_t) { return false; }
+			bool visit_bin(const char*, uint32_t) { return false; }
+			bool visit_ext(const char*, uint32_t) { return false; }
+			bool start_map(uint32_t) { return false; }
+
+			bool onArrayStart(uint32_t) { return true; }
+			bool onArrayEnd() { return true; }
+
+		protected:
+			static constexpr const int MAX_DEPTH = 8;
+			int _depth = -1;
+			uint32_t _index[MAX_DEPTH];
+			size_t _messageSize = 0;
+
+			// index of the current item within the array at the given depth
+			uint32_t index(int depth) const { return _index[depth]; }
+
+		private:
+			Derived& derived() { return *static_cast<Derived*>(this); }
+
+			bool value(const Number& n)
+			{
+				// version and message type were checked by PeekMessageType()
+				if (_depth < 1) { return (_depth == 0) && (index(0) < 2); }
+				return derived().onValue(n);
+			}
+	};
+
+	// the new segments of a bot are segments[firstSegment, firstSegment+segmentCount)
+	struct BotMoveUpdate
+	{
+		guid_t bot_id;
+		size_t length;
+		real_t radius;
+		size_t firstSegment;
+		size_t segmentCount;
+	};
+
+	// collects the updates of each bot into reused buffers, without building a message
+	class BotMoveVisitor : public ArrayVisitor<BotMoveVisitor>
+	{
+		public:
+			BotMoveVisitor(std::vector<BotMoveUpdate>& updates, std::vector<MsgPackProtocol::SnakeSegmentItem>& segments);
+			bool onArrayStart(uint32_t size);
+			bool onArrayEnd();
+			bool onValue(const Number& n);
+
+		private:
+			std::vector<BotMoveUpdate>& _updates;
+			std::vector<MsgPackProtocol::SnakeSegmentItem>& _segments;
+	};
+
+	class BotMoveHeadVisitor : public ArrayVisitor<BotMoveHeadVisitor>
+	{
+		public:
+			BotMoveHeadVisitor(MsgPackProtocol::BotMoveHeadMessage& msg);
+			bool onArrayStart(uint32_t size);
+			bool onValue(const Number& n);
+
+		private:
+			MsgPackProtocol::BotMoveHeadMessage& _msg;
+	};
+
+	class FoodSpawnVisitor : public ArrayVisitor<FoodSpawnVisitor>
+	{
+		public:
+			FoodSpawnVisitor(MsgPackProtocol::FoodSpawnMessage& msg);
+			bool onArrayStart(uint32_t size);
+			bool onValue(const Number& n);
+
+		private:
+			MsgPackProtocol::FoodSpawnMessage& _msg;
+	};
+
+	class FoodConsumeVisitor : public ArrayVisitor<FoodConsumeVisitor>
+	{
+		public:
+			FoodConsumeVisitor(MsgPackProtocol::FoodConsumeMessage& msg);
+			bool onArrayStart(uint32_t size);
+			bool onValue(const Number& n);
+
+		private:
+			MsgPackProtocol::FoodConsumeMessage& _msg;
+	};
+
+	class FoodDecayVisitor : public ArrayVisitor<FoodDecayVisitor>
+	{
+		public:
+			FoodDecayVisitor(MsgPackProtocol::FoodDecayMessage& msg);
+			bool onArrayStart(uint32_t size);
+			bool onValue(const Number& n);
+
+		private:
+			MsgPackProtocol::FoodDecayMessage& _msg;
+	};
+}
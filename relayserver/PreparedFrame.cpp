@@ -0,0 +1,82 @@
+#include "PreparedFrame.h"
+#include <stdio.h>
+#include "WebsocketConnection.h"
+#include "Deflater.h"
+
+PreparedFrame::PreparedFrame(const MessageBundle &bundle, uWS::OpCode opCode, bool asBundle, Compression compression)
+	: _bundle(bundle), _opCode(opCode), _asBundle(asBundle), _compression(compression)
+{
+}
+
+PreparedFrame::~PreparedFrame()
+{
+	for (auto* msg: _messages)
+	{
+		uWS::WebSocket<uWS::SERVER>::finalizeMessage(msg);
+	}
+}
+
+const std::vector<PreparedFrame::PreparedMessage*>& PreparedFrame::GetMessages()
+{
+	if (!_prepared)
+	{
+		if (_asBundle)
+		{
+			prepare(_bundle.data.data(), _bundle.data.size());
+		}
+		else
+		{
+			for (auto& item: _bundle.items)
+			{
+				prepare(&_bundle.data[item.first], item.second);
+			}
+		}
+		_prepared = true;
+	}
+	return _messages;
+}
+
+void PreparedFrame::prepare(const char *data, size_t length)
+{
+	auto opCode = _opCode;
+	bool compressed = false;
+	bool withDictionary = (_compression == COMPRESSION_DICTIONARY);
+	if (withDictionary || ((_compression == COMPRESSION_DEFLATE) && (length >= MIN_DEFLATE_SIZE)))
+	{
+		if (Deflater::Get(withDictionary).Compress(data, length, _compressed))
+		{
+			data = _compressed.data();
+			length = _compressed.size();
+			// dictionary clients inflate the payload themselves, permessage-deflate is flagged in the frame header
+			compressed = !withDictionary;
+			if (withDictionary)
+			{
+				opCode = uWS::OpCode::BINARY;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "deflate failed, sending uncompressed message\n");
+		}
+	}
+
+	// prepareMessage() only copies the payload, it never modifies it.
+	// The connections track their send queue through the callback.
+	_messages.push_back(uWS::WebSocket<uWS::SERVER>::prepareMessage(const_cast<char*>(data), length, opCode, compressed, &WebsocketConnection::onMessageSent));
+}
+
+PreparedFrameSet::PreparedFrameSet(const MessageBundle &json, const MessageBundle &msgpack)
+	: _json(json), _msgpack(msgpack)
+{
+}
+
+PreparedFrame& PreparedFrameSet::Select(bool msgPack, bool tickBundle, PreparedFrame::Compression compression)
+{
+	auto& frame = _frames[msgPack][tickBundle][compression];
+	if (!frame)
+	{
+		auto opCode = msgPack ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+		frame = std::make_unique<PreparedFrame>(msgPack ? _msgpack : _json, opCode, tickBundle, compression);
+	}
+	return *frame;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <uWS.h>
+#include "MessageBundle.h"
+
+// websocket frames of a MessageBundle, built on first use and shared by all sockets
+class PreparedFrame
+{
+	public:
+		typedef uWS::WebSocket<uWS::SERVER>::PreparedMessage PreparedMessage;
+
+		typedef enum
+		{
+			COMPRESSION_NONE,
+			// permessage-deflate negotiated with the client
+			COMPRESSION_DEFLATE,
+			// binary messages deflated with the preset dictionary, inflated by the client itself
+			COMPRESSION_DICTIONARY,
+			COMPRESSION_COUNT
+		} Compression;
+
+		// messages below this size are sent uncompressed with permessage-deflate
+		static constexpr const size_t MIN_DEFLATE_SIZE = 64;
+
+		// asBundle sends the whole bundle data as a single message instead of one message per item
+		PreparedFrame(const MessageBundle& bundle, uWS::OpCode opCode, bool asBundle, Compression compression = COMPRESSION_NONE);
+		~PreparedFrame();
+		PreparedFrame(const PreparedFrame&) = delete;
+		PreparedFrame& operator=(const PreparedFrame&) = delete;
+
+		const std::vector<PreparedMessage*>& GetMessages();
+
+	private:
+		const MessageBundle& _bundle;
+		uWS::OpCode _opCode;
+		bool _asBundle;
+		Compression _compression;
+		bool _prepared = false;
+		std::vector<PreparedMessage*> _messages;
+		std::string _compressed;
+
+		void prepare(const char* data, size_t length);
+};
+
+// a frame's messages in each of the encodings clients can choose from
+class PreparedFrameSet
+{
+	public:
+		PreparedFrameSet(const MessageBundle& json, const MessageBundle& msgpack);
+		// every variant is created (and compressed) once, when the first connection needs it
+		PreparedFrame& Select(bool msgPack, bool tickBundle, PreparedFrame::Compression compression);
+
+	private:
+		const MessageBundle& _json;
+		const MessageBundle& _msgpack;
+		std::unique_ptr<PreparedFrame> _frames[2][2][PreparedFrame::COMPRESSION_COUNT];
+};
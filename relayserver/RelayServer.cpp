@@ -1,90 +1,480 @@
 #include "RelayServer.h"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
 #include <sstream>
+#include <fcntl.h>
+#include <string.h>
 #include <TcpServer/EPoll.h>
 #include "JsonProtocol.h"
-
-RelayServer::RelayServer()
-{
-}
+#include "CompactProtocol.h"
+#include "PreparedFrame.h"
+#include "FrameData.h"
+#include "Deflater.h"
+#include "Metrics.h"
 
 int RelayServer::Run()
 {
-	uWS::Hub h;
-	EPoll epoll;
-
 	const char* gameserverHost = getEnvOrDefault(ENV_GAMESERVER_HOST, ENV_GAMESERVER_HOST_DEFAULT);
 	const char* gameserverPort = getEnvOrDefault(ENV_GAMESERVER_PORT, ENV_GAMESERVER_PORT_DEFAULT);
+	const char* rooms = getEnvOrDefault(ENV_ROOMS, ENV_ROOMS_DEFAULT);
 	const char* websocketPort = getEnvOrDefault(ENV_WEBSOCKET_PORT, ENV_WEBSOCKET_PORT_DEFAULT);
+	const char* websocketThreads = getEnvOrDefault(ENV_WEBSOCKET_THREADS, ENV_WEBSOCKET_THREADS_DEFAULT);
+	const char* deflateDictionary = getEnvOrDefault(ENV_DEFLATE_DICTIONARY, ENV_DEFLATE_DICTIONARY_DEFAULT);
+	const char* recordFile = getEnvOrDefault(ENV_RECORD_FILE, ENV_RECORD_FILE_DEFAULT);
+	const char* replayFile = getEnvOrDefault(ENV_REPLAY_FILE, ENV_REPLAY_FILE_DEFAULT);
+	const char* downstreamPort = getEnvOrDefault(ENV_DOWNSTREAM_PORT, ENV_DOWNSTREAM_PORT_DEFAULT);
 
-	fprintf(stderr, "connecting to gameserver on %s port %s...\n", gameserverHost , gameserverPort);
-	_clientSocket = connectTcpSocket(gameserverHost , gameserverPort);
-	if (_clientSocket < 0)
+	// the server side never refers to previous messages, so every compressed frame can be shared
+	_permessageDeflate = (strcmp(getEnvOrDefault(ENV_PERMESSAGE_DEFLATE, ENV_PERMESSAGE_DEFLATE_DEFAULT), "1") == 0);
+	int extensionOptions = _permessageDeflate ? (uWS::PERMESSAGE_DEFLATE | uWS::SERVER_NO_CONTEXT_TAKEOVER) : uWS::NO_OPTIONS;
+	if ((*deflateDictionary != '\0') && !loadDeflateDictionary(deflateDictionary))
+	{
+		return -1;
+	}
+	if (!setupRooms(rooms, gameserverHost, gameserverPort))
 	{
-		perror("connect to server failed");
 		return -1;
 	}
-	fprintf(stderr, "connected.\n");
+	if (strcmp(getEnvOrDefault(ENV_COMPACT_JSON, ENV_COMPACT_JSON_DEFAULT), "1") == 0)
+	{
+		for (auto& room: _rooms)
+		{
+			room->EnableCompactIds();
+		}
+		fprintf(stderr, "sending JSON in the compact format\n");
+	}
+
+	uWS::Hub h(extensionOptions);
+	EPoll epoll;
 
-	_tcpProtocol.SetFrameCompleteCallback(
-		[this, &h](uint64_t frame_id)
+	_backpressureLimits.maxBufferedBytes = strtoull(getEnvOrDefault(ENV_SLOW_CLIENT_MAX_BYTES, ENV_SLOW_CLIENT_MAX_BYTES_DEFAULT), nullptr, 10);
+	_backpressureLimits.maxFramesBehind = strtoul(getEnvOrDefault(ENV_SLOW_CLIENT_MAX_FRAMES, ENV_SLOW_CLIENT_MAX_FRAMES_DEFAULT), nullptr, 10);
+	_backpressureLimits.disconnect = (strcmp(getEnvOrDefault(ENV_SLOW_CLIENT_POLICY, ENV_SLOW_CLIENT_POLICY_DEFAULT), "disconnect") == 0);
+
+	auto& defaultRoom = *_rooms.front();
+	bool replaying = (*replayFile != '\0');
+	if (replaying)
+	{
+		// the default room plays the recording instead of connecting to its gameserver
+		defaultRoom.gameserverHost.clear();
+		if (!_replay.Open(replayFile))
 		{
-			auto &logMessages = _tcpProtocol.GetPendingLogItems();
-			h.getDefaultGroup<uWS::SERVER>().forEach(
-				[this, frame_id, &logMessages](uWS::WebSocket<uWS::SERVER>* sock)
-				{
-					auto con = static_cast<WebsocketConnection*>(sock->getUserData());
-					con->FrameComplete(frame_id, _tcpProtocol);
+			return -1;
+		}
+		_replay.SetSpeed(atof(getEnvOrDefault(ENV_REPLAY_SPEED, ENV_REPLAY_SPEED_DEFAULT)));
+		if (!_replay.Seek(strtoull(getEnvOrDefault(ENV_REPLAY_START_FRAME, ENV_REPLAY_START_FRAME_DEFAULT), nullptr, 10)))
+		{
+			return -1;
+		}
+	}
 
-					auto key = con->getViewerKey();
-					if (logMessages.find(key) != logMessages.end())
+	if (*recordFile != '\0')
+	{
+		if (!_recorder.Open(recordFile))
+		{
+			return -1;
+		}
+		fprintf(stderr, "recording to %s\n", recordFile);
+	}
+
+	if (*downstreamPort != '\0')
+	{
+		int port = atoi(downstreamPort);
+		for (size_t i=0; i<_rooms.size(); i++)
+		{
+			auto& room = *_rooms[i];
+			room.downstream = std::make_unique<DownstreamServer>(room.tcpProtocol);
+			if (!room.downstream->Listen(port + static_cast<int>(i), epoll))
+			{
+				return -1;
+			}
+			fprintf(stderr, "serving room '%s' to downstream relays on port %d\n", room.name.c_str(), port + static_cast<int>(i));
+		}
+	}
+
+	auto listenPort = atoi(websocketPort);
+	auto threadCount = atoi(websocketThreads);
+	// allocated up front, the hubs' threads only fill in their own entry
+	size_t hubCount = static_cast<size_t>(std::max(threadCount, 1));
+	for (size_t i=0; i<_rooms.size(); i++)
+	{
+		for (size_t j=0; j<hubCount; j++)
+		{
+			_rooms[i]->hubs.push_back(std::make_unique<Room::HubState>());
+		}
+		setupRoom(i);
+	}
+
+	if (threadCount > 0)
+	{
+		fprintf(stderr, "listening on port %d with %d threads...\n", listenPort, threadCount);
+		if (!startWorkers(threadCount, listenPort, extensionOptions))
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		setupHub(h, 0, extensionOptions, true);
+		fprintf(stderr, "listening on port %d...\n", listenPort);
+		if (!h.listen(listenPort))
+		{
+			return -1;
+		}
+		epoll.AddFileDescriptor(h.getLoop()->getEpollFd(), EPOLLIN|EPOLLPRI|EPOLLERR|EPOLLRDHUP|EPOLLHUP); // TODO check which events are neccessary
+	}
+
+	auto& metrics = Metrics::Get();
+	while (true)
+	{
+		int timeout = 1000;
+		uint64_t busySince = 0;
+		if (replaying)
+		{
+			busySince = Metrics::NowNs();
+			timeout = playReplay(defaultRoom);
+			if (timeout < 0)
+			{
+				fprintf(stderr, "end of recording.\n");
+				break;
+			}
+			timeout = std::min(timeout, 1000);
+		}
+		for (auto& room: _rooms)
+		{
+			if (!room->gameserverHost.empty())
+			{
+				timeout = std::min(timeout, updateUpstream(*room, epoll));
+			}
+		}
+
+		epoll.Poll(timeout,
+			[this, &h, &epoll, &busySince](const epoll_event& ev)
+			{
+				if (busySince == 0) { busySince = Metrics::NowNs(); }
+				for (auto& room: _rooms)
+				{
+					if ((room->clientSocket >= 0) && (ev.data.fd == room->clientSocket))
 					{
-						for (auto& item: logMessages.at(key))
+						if (!handleUpstreamEvent(*room, epoll))
 						{
-							con->LogMessage(frame_id, item.message);
+							disconnectUpstream(*room, epoll);
 						}
+						return true;
 					}
+					if (room->downstream && room->downstream->HandleEvent(ev))
+					{
+						return true;
+					}
+				}
+				h.poll();
+				return true;
+			}
+		);
+		if (busySince != 0)
+		{
+			metrics.eventLoopLagNs.Observe(Metrics::NowNs() - busySince);
+		}
+	}
+
+	_workers.clear();
+	return -2;
+}
+
+// a comma separated list of name=host:port, or the default room on GAMESERVER_HOST and _PORT if empty
+bool RelayServer::setupRooms(const char *rooms, const char *gameserverHost, const char *gameserverPort)
+{
+	std::string list(rooms);
+	if (list.empty())
+	{
+		_rooms.push_back(std::make_unique<Room>("", gameserverHost, gameserverPort));
+		return true;
+	}
+
+	size_t start = 0;
+	while (start < list.size())
+	{
+		size_t end = std::min(list.find(',', start), list.size());
+		std::string entry = list.substr(start, end-start);
+		start = end + 1;
+
+		size_t eq = entry.find('=');
+		size_t colon = entry.rfind(':');
+		if ((eq == std::string::npos) || (colon == std::string::npos) || (colon < eq))
+		{
+			fprintf(stderr, "invalid room %s, expected name=host:port\n", entry.c_str());
+			return false;
+		}
+		// the room name is the first part of the URL path, so it must not shadow the HTTP endpoints
+		std::string name = entry.substr(0, eq);
+		if (name.empty() || (name.find('/') != std::string::npos) || (name == PATH_STATS) ||
+			(name == PATH_METRICS) || (name == PATH_DICTIONARY) || findRoom(name))
+		{
+			fprintf(stderr, "invalid room name '%s'\n", name.c_str());
+			return false;
+		}
+		_rooms.push_back(std::make_unique<Room>(name, entry.substr(eq+1, colon-eq-1), entry.substr(colon+1)));
+		fprintf(stderr, "room %s on gameserver %s\n", name.c_str(), entry.substr(eq+1).c_str());
+	}
+	return !_rooms.empty();
+}
+
+void RelayServer::setupRoom(size_t roomIndex)
+{
+	auto& room = *_rooms[roomIndex];
+	// connected from the event loop, clients are served while the gameserver is unavailable
+	room.reconnectDelayMs = RECONNECT_DELAY_MIN_MS;
+	room.upstreamTimeout = Clock::now();
+
+	bool record = (roomIndex == 0) && _recorder.IsOpen();
+	if (record || room.downstream)
+	{
+		room.tcpProtocol.SetRawMessageCallback(
+			[this, &room, record](const char* data, size_t size)
+			{
+				if (record)
+				{
+					_recorder.Write(data, size);
+				}
+				if (room.downstream)
+				{
+					room.downstream->Forward(data, size);
 				}
-			);
-			_tcpProtocol.ClearLogItems();
+			}
+		);
+	}
 
-			for (auto& msg: _tcpProtocol.GetPendingMessages())
+	room.tcpProtocol.SetMetrics(&Metrics::Get());
+	room.tcpProtocol.SetFrameCompleteCallback(
+		[this, &room, roomIndex](uint64_t frame_id)
+		{
+			bool resync = room.upstreamResync;
+			beginUpstreamFrame(room);
+			// ids are assigned for every frame, also while nobody watches
+			if (room.compactIds)
+			{
+				room.compactIds->Update(room.tcpProtocol, Room::Clock::now());
+			}
+			if (roomIndex == 0)
+			{
+				_recorder.MarkFrame(frame_id);
+			}
+			if (room.downstream)
+			{
+				room.downstream->FrameComplete();
+			}
+			updateCoalescers(room);
+			bool statsChanged = room.statsChanged && (room.statsSubscribers.load(std::memory_order_relaxed) > 0);
+			room.statsChanged = false;
+			// an idle room only keeps its world state up to date, new clients start with a snapshot anyway
+			if (_workers.empty())
+			{
+				if (statsChanged)
+				{
+					pushStats(*room.hubs[0], *room.stats.Get());
+				}
+				if (room.clients.load(std::memory_order_relaxed) > 0)
+				{
+					broadcastFrame(room, *room.hubs[0]->group, frame_id, resync);
+				}
+			}
+			else if (statsChanged || (room.clients.load(std::memory_order_relaxed) > 0))
 			{
-				std::string s = json(*msg).dump();
-				h.getDefaultGroup<uWS::SERVER>().broadcast(s.data(), s.length(), uWS::OpCode::TEXT);
+				publishFrame(roomIndex, frame_id, resync, statsChanged);
 			}
+			room.tcpProtocol.ClearLogItems();
 		}
 	);
 
-	_tcpProtocol.SetStatsReceivedCallback([this](const MsgPackProtocol::BotStatsMessage& msg) {
-		std::string content = json(msg).dump();
-		std::stringstream s;
-		s << "HTTP/1.0 200 OK\r\n";
-		s << "Content-Length: " << content.size() << "\r\n";
-		s << "Content-Type: application/json; charset=UTF-8\r\n\r\n";
-		s << content;
-		_statsHTTPResponse = s.str();
+	room.tcpProtocol.SetStatsReceivedCallback([&room](const MsgPackProtocol::BotStatsMessage& msg) {
+		if (room.stats.Update(msg))
+		{
+			room.statsChanged = true;
+		}
 	});
+}
 
-	epoll.AddFileDescriptor(_clientSocket, EPOLLIN|EPOLLPRI|EPOLLERR);
+void RelayServer::setupHub(uWS::Hub &h, size_t hubIndex, int extensionOptions, bool viewportsEnabled)
+{
+	for (auto& room: _rooms)
+	{
+		auto* group = h.createGroup<uWS::SERVER>(extensionOptions);
+		room->hubs[hubIndex]->group = group;
+		setupRoomGroup(*room, *group, viewportsEnabled);
+	}
 
+	// connections start out in the hub's default group and move on to the group of their room
 	h.onConnection(
-		[](uWS::WebSocket<uWS::SERVER> *ws, uWS::HttpRequest req)
+		[this, hubIndex](uWS::WebSocket<uWS::SERVER> *ws, uWS::HttpRequest req)
 		{
-			ws->setUserData(new WebsocketConnection(ws));
+			std::string url = req.getUrl().toString();
+			Room* room = findRoom(getPath(url));
+			if (!room)
+			{
+				ws->close(404, "unknown room");
+				return;
+			}
+			auto& hub = *room->hubs[hubIndex];
+
+			// before anything is counted for the connection
+			std::string types = getQueryParameter(url, QUERY_TYPES);
+			Subscription::Mask subscription = Subscription::ALL;
+			if (!types.empty() && !Subscription::Parse(types, subscription))
+			{
+				ws->close(418, "invalid types");
+				return;
+			}
+
+			auto *con = new WebsocketConnection(ws, _backpressureLimits, hub.logRouter);
+			con->setTickBundleEnabled(getQueryParameter(url, QUERY_TICK_BUNDLE) == "1");
+
+			auto subprotocol = req.getHeader("sec-websocket-protocol");
+			bool msgpackRequested = subprotocol && headerListContains(subprotocol.toString(), FORMAT_MSGPACK);
+			con->setMsgPackEnabled(msgpackRequested || (getQueryParameter(url, QUERY_FORMAT) == FORMAT_MSGPACK));
+
+			// uWS accepts every permessage-deflate offer if the extension is enabled
+			auto extensions = req.getHeader("sec-websocket-extensions");
+			if (getQueryParameter(url, QUERY_DEFLATE_DICTIONARY) == "1")
+			{
+				con->setCompression(PreparedFrame::COMPRESSION_DICTIONARY);
+			}
+			else if (_permessageDeflate && extensions && (extensions.toString().find("permessage-deflate") != std::string::npos))
+			{
+				con->setCompression(PreparedFrame::COMPRESSION_DEFLATE);
+			}
+
+			con->setSubscription(subscription);
+			countSubscription(*room, *con, 1);
+			std::string maxRate = getQueryParameter(url, QUERY_MAX_RATE);
+			if (!maxRate.empty())
+			{
+				setMaxRate(*room, *con, atof(maxRate.c_str()));
+			}
+			ws->setUserData(con);
+			room->clients.fetch_add(1, std::memory_order_relaxed);
+			Metrics::Get().connectedClients.fetch_add(1, std::memory_order_relaxed);
+			// same loop, so the socket is in its room's group when this returns
+			ws->transfer(hub.group);
 		}
 	);
 
-	h.onDisconnection(
-		[](uWS::WebSocket<uWS::SERVER> *ws, int code, const char *message, size_t length)
+	h.onHttpRequest([this, hubIndex](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t length, size_t remainingBytes)
+	{
+		// /stats for the default room, /<room>/stats for the others
+		std::string path = getPath(req.getUrl().toString());
+		size_t slash = path.rfind('/');
+		std::string roomName = (slash == std::string::npos) ? "" : path.substr(0, slash);
+		std::string resource = (slash == std::string::npos) ? path : path.substr(slash+1);
+		Room* room = findRoom(roomName);
+		bool get = (req.getMethod()==uWS::METHOD_GET);
+
+		if (get && room && (resource == PATH_STATS))
+		{
+			auto stats = room->stats.Get();
+			auto accept = req.getHeader("accept");
+			if (accept && (accept.toString().find("text/event-stream") != std::string::npos))
+			{
+				// server-sent events: the response stays open and gets every new stats body
+				auto& header = StatsCache::GetEventStreamHeader();
+				res->write(header.data(), header.length());
+				if (stats)
+				{
+					res->write(stats->event.data(), stats->event.length());
+				}
+				room->hubs[hubIndex]->statsSubscribers.push_back(res);
+				room->statsSubscribers.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (!stats)
+			{
+				res->end();
+				return;
+			}
+
+			const std::string* response = &stats->identity;
+			auto ifNoneMatch = req.getHeader("if-none-match");
+			auto acceptEncoding = req.getHeader("accept-encoding");
+			if (ifNoneMatch && (headerListContains(ifNoneMatch.toString(), stats->etag) || headerListContains(ifNoneMatch.toString(), "*")))
+			{
+				response = &stats->notModified;
+			}
+			else if (acceptEncoding && headerListContains(acceptEncoding.toString(), "gzip"))
+			{
+				response = &stats->gzip;
+			}
+			res->write(response->data(), response->length());
+			res->end();
+			return;
+		}
+		if (get && roomName.empty() && (resource == PATH_METRICS))
+		{
+			std::string content;
+			Metrics::Get().Write(content);
+			std::stringstream s;
+			s << "HTTP/1.0 200 OK\r\n";
+			s << "Content-Length: " << content.size() << "\r\n";
+			s << "Content-Type: text/plain; version=0.0.4; charset=UTF-8\r\n\r\n";
+			s << content;
+			std::string response = s.str();
+			res->write(response.data(), response.length());
+			res->end();
+			return;
+		}
+		if (get && roomName.empty() && (resource == PATH_DICTIONARY))
+		{
+			// preset dictionary for clients connecting with ?dictionary=1
+			auto& dictionary = Deflater::GetDictionary();
+			std::stringstream s;
+			s << "HTTP/1.0 200 OK\r\n";
+			s << "Content-Length: " << dictionary.size() << "\r\n";
+			s << "Content-Type: application/octet-stream\r\n\r\n";
+			s << dictionary;
+			std::string response = s.str();
+			res->write(response.data(), response.length());
+			res->end();
+			return;
+		}
+		res->end(HTTP_DEFAULT_RESPONSE, strlen(HTTP_DEFAULT_RESPONSE));
+	});
+
+	// the client of a streaming /stats request went away
+	h.onCancelledHttpRequest([this, hubIndex](uWS::HttpResponse *res)
+	{
+		for (auto& room: _rooms)
+		{
+			auto& subscribers = room->hubs[hubIndex]->statsSubscribers;
+			auto it = std::find(subscribers.begin(), subscribers.end(), res);
+			if (it != subscribers.end())
+			{
+				subscribers.erase(it);
+				room->statsSubscribers.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+	});
+}
+
+void RelayServer::setupRoomGroup(Room &room, uWS::Group<uWS::SERVER> &group, bool viewportsEnabled)
+{
+	group.onDisconnection(
+		[this, &room](uWS::WebSocket<uWS::SERVER> *ws, int code, const char *message, size_t length)
 		{
 			auto *con = static_cast<WebsocketConnection*>(ws->getUserData());
+			if (con->getRateClass() >= 0)
+			{
+				room.rateClassClients[con->getRateClass()].fetch_sub(1, std::memory_order_relaxed);
+			}
+			countSubscription(room, *con, -1);
 			delete con;
+			room.clients.fetch_sub(1, std::memory_order_relaxed);
+			Metrics::Get().connectedClients.fetch_sub(1, std::memory_order_relaxed);
 		}
 	);
 
-	h.onMessage([](uWS::WebSocket<uWS::SERVER> *ws, char *message, size_t length, uWS::OpCode opCode)
+	group.onMessage([this, &room, viewportsEnabled](uWS::WebSocket<uWS::SERVER> *ws, char *message, size_t length, uWS::OpCode opCode)
 	{	
 		if (length>MAX_CLIENT_MESSAGE_SIZE)
 		{
@@ -103,6 +493,54 @@ int RelayServer::Run()
 				std::string key = data["viewer_key"];
 				con->setViewerKey(static_cast<uint64_t>(std::stol(key)));
 			}
+
+			// {"max_rate": 10} in updates per second, 0 for every frame
+			if (data["max_rate"].is_number())
+			{
+				setMaxRate(room, *con, data["max_rate"]);
+			}
+
+			// {"types": ["BotSpawn", "BotKill", "BotMoveHead"]}, null for all message types
+			if (data.count("types"))
+			{
+				auto& types = data["types"];
+				bool valid = types.is_null() || types.is_array();
+				std::string names;
+				for (auto& type: types)
+				{
+					if (!type.is_string()) { valid = false; break; }
+					names += (names.empty() ? "" : ",") + type.get<std::string>();
+				}
+				Subscription::Mask subscription = Subscription::ALL;
+				if (!valid || (!types.is_null() && !Subscription::Parse(names, subscription)))
+				{
+					ws->close(418, "invalid types");
+					return;
+				}
+				setSubscription(room, *con, subscription);
+			}
+
+			// {"viewport": {"x": .., "y": .., "width": .., "height": .., "zoom": ..}}, null for the whole world.
+			// Fan-out threads have no access to the world state, so they ignore viewports.
+			if (viewportsEnabled && data.count("viewport"))
+			{
+				auto& viewport = data["viewport"];
+				if (viewport.is_null())
+				{
+					con->disableViewport();
+					return;
+				}
+
+				real_t width = viewport.at("width");
+				real_t height = viewport.at("height");
+				real_t zoom = viewport.value("zoom", 1.0f);
+				if (!(width > 0) || !(height > 0) || !(zoom > 0))
+				{
+					ws->close(418, "invalid viewport");
+					return;
+				}
+				con->setViewport(viewport.at("x"), viewport.at("y"), width, height, zoom);
+			}
 		}
 		catch (std::exception e)
 		{
@@ -110,84 +548,608 @@ int RelayServer::Run()
 			return;
 		}
 	});
+}
 
-	std::string response = "nope.";
-	h.onHttpRequest([&](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t length, size_t remainingBytes)
+// the default room for an empty name, nullptr if there is no such room
+Room* RelayServer::findRoom(const std::string &name)
+{
+	if (name.empty())
 	{
-		if ((req.getMethod()==uWS::METHOD_GET) && (req.getUrl().toString()=="/stats"))
+		return _rooms.empty() ? nullptr : _rooms.front().get();
+	}
+	for (auto& room: _rooms)
+	{
+		if (room->name == name) { return room.get(); }
+	}
+	return nullptr;
+}
+
+void RelayServer::broadcastFrame(Room& room, uWS::Group<uWS::SERVER>& group, uint64_t frame_id, bool resync)
+{
+	writeJsonFrame(room, _jsonBundle);
+	SubscriptionFrames frames(_jsonBundle, room.tcpProtocol.GetPendingRawMessages());
+	Metrics::Get().frameJsonBytes.Observe(_jsonBundle.data.size());
+
+	MergedFrameSets merged;
+	for (size_t i=0; i<FrameCoalescer::RATE_CLASS_COUNT; i++)
+	{
+		if (room.rateClassDue[i])
 		{
-			res->write(_statsHTTPResponse.data(), _statsHTTPResponse.length());
-			res->end();
-			return;
+			merged[i] = std::make_unique<SubscriptionFrames>(room.coalescers[i]->GetJson(), room.coalescers[i]->GetMsgPack());
 		}
-		res->end(response.data(), response.length());
-	});
+	}
 
-	auto listenPort = atoi(websocketPort);
-	fprintf(stderr, "listening on port %d...\n", listenPort);
-	if (!h.listen(listenPort))
+	Histogram::Counts sendQueueBytes;
+	group.forEach(
+		[&](uWS::WebSocket<uWS::SERVER>* sock)
+		{
+			auto con = static_cast<WebsocketConnection*>(sock->getUserData());
+			if (resync)
+			{
+				con->resync();
+			}
+			sendQueueBytes.Observe(con->getBufferedBytes());
+			if (!con->beginFrame()) { return; }
+			con->FrameComplete(frame_id, room.snapshotCache);
+
+			// viewport frames are never merged
+			if (con->isViewportEnabled())
+			{
+				con->sendViewportFrame(room.tcpProtocol, room.compactIds.get());
+			}
+			else
+			{
+				sendFrame(*con, frames, merged);
+			}
+			con->endFrame();
+		}
+	);
+
+	Metrics::Get().sendQueueBytes.Add(sendQueueBytes);
+
+	room.hubs[0]->logRouter.Deliver(frame_id, room.tcpProtocol.GetPendingLogItems());
+}
+
+// the frame's messages of the types any JSON connection subscribed to, encoded once for all of them
+void RelayServer::writeJsonFrame(Room &room, MessageBundle &bundle)
+{
+	auto& messages = room.tcpProtocol.GetPendingMessages();
+	Subscription::Mask mask = room.GetJsonSubscriptions();
+	if (mask == Subscription::ALL)
 	{
-		return -1;
+		CompactProtocol::writeJsonBundle(bundle, messages, room.compactIds.get(), CompactProtocol::INFO_NEW);
+		return;
 	}
 
-	epoll.AddFileDescriptor(h.getLoop()->getEpollFd(), EPOLLIN|EPOLLPRI|EPOLLERR|EPOLLRDHUP|EPOLLHUP); // TODO check which events are neccessary
-	bool shouldRun = true;
-	while (shouldRun)
+	_jsonMessages.clear();
+	for (auto& msg: messages)
+	{
+		if (Subscription::GetBit(msg->messageType) & mask)
+		{
+			_jsonMessages.push_back(msg);
+		}
+	}
+	CompactProtocol::writeJsonBundle(bundle, _jsonMessages, room.compactIds.get(), CompactProtocol::INFO_NEW);
+}
+
+// the shared frame of the connection's subscription class, or for rate limited connections
+// the merged frame of their rate class when it is due
+void RelayServer::sendFrame(WebsocketConnection &con, SubscriptionFrames &frames, MergedFrameSets &merged)
+{
+	bool msgPack = con.isMsgPackEnabled();
+	int rateClass = con.getRateClass();
+	if ((rateClass >= 0) && con.isCoalescing())
+	{
+		if (merged[rateClass])
+		{
+			con.sendPrepared(merged[rateClass]->Get(con.getSubscription(), msgPack).Select(msgPack, con.isTickBundleEnabled(), con.getCompression()));
+		}
+		return;
+	}
+
+	con.sendPrepared(frames.Get(con.getSubscription(), msgPack).Select(msgPack, con.isTickBundleEnabled(), con.getCompression()));
+	// the next merged frame starts right after this one
+	if ((rateClass >= 0) && merged[rateClass])
+	{
+		con.startCoalescing();
+	}
+}
+
+// may be called on any thread, 0 or less for every frame
+void RelayServer::setMaxRate(Room &room, WebsocketConnection &con, double maxRate)
+{
+	int rateClass = FrameCoalescer::SelectRateClass(maxRate);
+	int oldRateClass = con.getRateClass();
+	if (rateClass == oldRateClass) { return; }
+
+	countSubscription(room, con, -1);
+	if (oldRateClass >= 0)
+	{
+		room.rateClassClients[oldRateClass].fetch_sub(1, std::memory_order_relaxed);
+	}
+	if (rateClass >= 0)
 	{
-		epoll.Poll(1000,
-			[this, &h, &shouldRun](const epoll_event& ev)
+		room.rateClassClients[rateClass].fetch_add(1, std::memory_order_relaxed);
+	}
+	con.setRateClass(rateClass);
+	countSubscription(room, con, 1);
+}
+
+// writes the new stats event to the hub's streaming /stats requests, on the hub's thread
+void RelayServer::pushStats(Room::HubState &hub, const StatsCache::Responses &stats)
+{
+	for (auto* res: hub.statsSubscribers)
+	{
+		res->write(stats.event.data(), stats.event.length());
+	}
+}
+
+// may be called on any thread
+void RelayServer::setSubscription(Room &room, WebsocketConnection &con, Subscription::Mask mask)
+{
+	countSubscription(room, con, -1);
+	con.setSubscription(mask);
+	countSubscription(room, con, 1);
+}
+
+// msgpack frames are passed through as received, so only JSON connections count for the full stream.
+// Merged frames are encoded in both formats, so all connections of a rate class count for it.
+void RelayServer::countSubscription(Room &room, const WebsocketConnection &con, int delta)
+{
+	int rateClass = con.getRateClass();
+	for (size_t i=0; i<Subscription::BIT_COUNT; i++)
+	{
+		if (!(con.getSubscription() & (1u << i))) { continue; }
+		if (!con.isMsgPackEnabled())
+		{
+			room.jsonSubscribers[i].fetch_add(delta, std::memory_order_relaxed);
+		}
+		if (rateClass >= 0)
+		{
+			room.rateClassSubscribers[rateClass][i].fetch_add(delta, std::memory_order_relaxed);
+		}
+	}
+}
+
+// merges the current frame into the rate classes that have clients
+void RelayServer::updateCoalescers(Room &room)
+{
+	auto now = FrameCoalescer::Clock::now();
+	for (size_t i=0; i<FrameCoalescer::RATE_CLASS_COUNT; i++)
+	{
+		room.rateClassDue[i] = false;
+		if (room.rateClassClients[i].load(std::memory_order_relaxed) == 0)
+		{
+			room.coalescers[i]->Reset();
+			continue;
+		}
+		room.rateClassDue[i] = room.coalescers[i]->AddFrame(room.tcpProtocol.GetPendingMessages(), room.GetRateClassSubscriptions(i), now);
+	}
+}
+
+// starts a connection attempt when the reconnect delay has passed, returns the milliseconds until the next one
+int RelayServer::updateUpstream(Room &room, EPoll &epoll)
+{
+	auto now = Clock::now();
+	if (room.upstreamState == Room::UPSTREAM_CONNECTED)
+	{
+		return 1000;
+	}
+	if (now < room.upstreamTimeout)
+	{
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(room.upstreamTimeout - now).count() + 1;
+		return static_cast<int>(std::min<decltype(remaining)>(remaining, 1000));
+	}
+	if (room.upstreamState == Room::UPSTREAM_CONNECTING)
+	{
+		fprintf(stderr, "connecting to gameserver on %s port %s timed out\n", room.gameserverHost.c_str(), room.gameserverPort.c_str());
+		disconnectUpstream(room, epoll);
+		return room.reconnectDelayMs;
+	}
+
+	fprintf(stderr, "connecting to gameserver on %s port %s...\n", room.gameserverHost.c_str(), room.gameserverPort.c_str());
+	room.clientSocket = connectTcpSocket(room.gameserverHost.c_str(), room.gameserverPort.c_str(), room.connectAttempts++);
+	if (room.clientSocket < 0)
+	{
+		disconnectUpstream(room, epoll);
+		return room.reconnectDelayMs;
+	}
+	// writable once the connection is established or failed
+	epoll.AddFileDescriptor(room.clientSocket, EPOLLOUT|EPOLLERR|EPOLLHUP);
+	room.upstreamState = Room::UPSTREAM_CONNECTING;
+	room.upstreamTimeout = now + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+	return CONNECT_TIMEOUT_MS;
+}
+
+// false if the connection failed or was lost
+bool RelayServer::handleUpstreamEvent(Room &room, EPoll &epoll)
+{
+	if (room.upstreamState == Room::UPSTREAM_CONNECTED)
+	{
+		return room.tcpProtocol.Read(room.clientSocket);
+	}
+
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(room.clientSocket, SOL_SOCKET, SO_ERROR, &error, &length) != 0)
+	{
+		error = errno;
+	}
+	if (error != 0)
+	{
+		fprintf(stderr, "connect to gameserver on %s port %s failed: %s\n", room.gameserverHost.c_str(), room.gameserverPort.c_str(), strerror(error));
+		return false;
+	}
+
+	epoll.DeleteFileDescriptor(room.clientSocket);
+	epoll.AddFileDescriptor(room.clientSocket, EPOLLIN|EPOLLPRI|EPOLLERR);
+	room.upstreamState = Room::UPSTREAM_CONNECTED;
+	room.connectAttempts = 0;
+	fprintf(stderr, "connected to gameserver on %s port %s.\n", room.gameserverHost.c_str(), room.gameserverPort.c_str());
+	return true;
+}
+
+// closes the upstream connection (or attempt) and schedules the next attempt
+void RelayServer::disconnectUpstream(Room &room, EPoll &epoll)
+{
+	if (room.clientSocket >= 0)
+	{
+		epoll.DeleteFileDescriptor(room.clientSocket);
+		close(room.clientSocket);
+		room.clientSocket = -1;
+	}
+	if (room.upstreamState == Room::UPSTREAM_CONNECTED)
+	{
+		fprintf(stderr, "lost connection to gameserver on %s port %s\n", room.gameserverHost.c_str(), room.gameserverPort.c_str());
+		// the state is rebuilt from the GameInfo and WorldUpdate of the next connection
+		room.tcpProtocol.Reset();
+		room.upstreamResync = true;
+		if (room.downstream)
+		{
+			room.downstream->DisconnectAll();
+		}
+	}
+
+	room.upstreamState = Room::UPSTREAM_DISCONNECTED;
+	room.upstreamTimeout = Clock::now() + std::chrono::milliseconds(room.reconnectDelayMs);
+	fprintf(stderr, "reconnecting in %d ms\n", room.reconnectDelayMs);
+	room.reconnectDelayMs = (room.reconnectDelayMs < RECONNECT_DELAY_MAX_MS / 2) ? room.reconnectDelayMs * 2 : RECONNECT_DELAY_MAX_MS;
+}
+
+// a complete frame means the upstream connection works, the first one after a reconnect replaces the connections' state
+void RelayServer::beginUpstreamFrame(Room &room)
+{
+	room.reconnectDelayMs = RECONNECT_DELAY_MIN_MS;
+	if (!room.upstreamResync) { return; }
+
+	room.upstreamResync = false;
+	room.snapshotCache.Invalidate();
+	if (room.compactIds)
+	{
+		room.compactIds->Reset();
+	}
+	for (auto& coalescer: room.coalescers)
+	{
+		coalescer->Reset();
+	}
+}
+
+// feeds the next recorded frame if it is due, returns the milliseconds until the one after it, -1 at the end
+int RelayServer::playReplay(Room &room)
+{
+	if (_replay.GetTimeout() == 0)
+	{
+		const char* data;
+		size_t size;
+		if (!_replay.NextFrame(data, size) || !room.tcpProtocol.Process(data, size))
+		{
+			return -1;
+		}
+	}
+	return _replay.GetTimeout();
+}
+
+bool RelayServer::startWorkers(int count, int port, int extensionOptions)
+{
+	for (int i=0; i<count; i++)
+	{
+		size_t hubIndex = static_cast<size_t>(i);
+		_workers.push_back(std::make_unique<FanoutWorker>(
+			[this, hubIndex, extensionOptions](FanoutWorker& worker, uWS::Hub& hub)
 			{
-				if (ev.data.fd == _clientSocket)
+				setupHub(hub, hubIndex, extensionOptions, false);
+				for (auto& room: _rooms)
 				{
-					shouldRun = _tcpProtocol.Read(_clientSocket);
-					return shouldRun;
+					worker.AddGroup(room->hubs[hubIndex]->group);
 				}
-				else
+			},
+			[this, hubIndex](FanoutWorker&, uWS::Group<uWS::SERVER>&, const FrameData& frame, bool resync)
+			{
+				broadcastWorkerFrame(hubIndex, frame, resync);
+			}
+		));
+		if (!_workers.back()->Start(port, extensionOptions))
+		{
+			fprintf(stderr, "fan-out thread %d failed to listen on port %d\n", i, port);
+			_workers.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+// runs on the ingest thread, encodes the frame once for all workers
+void RelayServer::publishFrame(size_t roomIndex, uint64_t frame_id, bool resync, bool statsChanged)
+{
+	auto& room = *_rooms[roomIndex];
+	auto frame = std::make_shared<FrameData>();
+	frame->room = roomIndex;
+	frame->frame_id = frame_id;
+	frame->resync = resync;
+	writeJsonFrame(room, frame->json);
+	frame->msgpack = room.tcpProtocol.GetPendingRawMessages();
+	frame->logItems = room.tcpProtocol.GetPendingLogItems();
+	if (statsChanged)
+	{
+		frame->stats = room.stats.Get();
+	}
+	Metrics::Get().frameJsonBytes.Observe(frame->json.data.size());
+	for (size_t i=0; i<FrameCoalescer::RATE_CLASS_COUNT; i++)
+	{
+		frame->rateClassDue[i] = room.rateClassDue[i];
+		if (room.rateClassDue[i])
+		{
+			frame->rateClassJson[i] = room.coalescers[i]->GetJson();
+			frame->rateClassMsgPack[i] = room.coalescers[i]->GetMsgPack();
+		}
+	}
+
+	bool snapshotRequested = resync;
+	for (auto& hub: room.hubs)
+	{
+		snapshotRequested = hub->snapshotRequested.exchange(false) || snapshotRequested;
+	}
+	if (snapshotRequested)
+	{
+		frame->hasSnapshot = true;
+		for (int format=0; format<SnapshotCache::FORMAT_COUNT; format++)
+		{
+			frame->snapshots[format] = room.snapshotCache.GetBundle(static_cast<SnapshotCache::Format>(format), frame_id);
+		}
+	}
+
+	for (auto& worker: _workers)
+	{
+		worker->Publish(frame);
+	}
+}
+
+// runs on the worker thread, resync: frames of any room might have been dropped
+void RelayServer::broadcastWorkerFrame(size_t workerIndex, const FrameData& frame, bool resync)
+{
+	uint64_t start = Metrics::NowNs();
+	if (resync)
+	{
+		for (auto& room: _rooms)
+		{
+			room->hubs[workerIndex]->resyncPending = true;
+		}
+	}
+	auto& room = *_rooms[frame.room];
+	auto& hub = *room.hubs[workerIndex];
+	resync = hub.resyncPending || frame.resync;
+	hub.resyncPending = false;
+
+	SubscriptionFrames frames(frame.json, frame.msgpack);
+	PreparedFrameSet snapshots(frame.snapshots[SnapshotCache::FORMAT_JSON], frame.snapshots[SnapshotCache::FORMAT_MSGPACK]);
+	MergedFrameSets merged;
+	for (size_t i=0; i<FrameCoalescer::RATE_CLASS_COUNT; i++)
+	{
+		if (frame.rateClassDue[i])
+		{
+			merged[i] = std::make_unique<SubscriptionFrames>(frame.rateClassJson[i], frame.rateClassMsgPack[i]);
+		}
+	}
+
+	bool snapshotRequired = false;
+	Histogram::Counts sendQueueBytes;
+	hub.group->forEach(
+		[&](uWS::WebSocket<uWS::SERVER>* sock)
+		{
+			auto con = static_cast<WebsocketConnection*>(sock->getUserData());
+			if (resync)
+			{
+				con->resync();
+			}
+			sendQueueBytes.Observe(con->getBufferedBytes());
+			if (!con->beginFrame()) { return; }
+			if (con->needsInitialData())
+			{
+				// nothing to send until the snapshot arrives with one of the next frames
+				if (!frame.hasSnapshot)
 				{
-					h.poll();
+					snapshotRequired = true;
+					return;
 				}
-				return true;
+				bool msgPack = (con->getSnapshotFormat() == SnapshotCache::FORMAT_MSGPACK);
+				con->sendInitialData(snapshots.Select(msgPack, false, con->getCompression()));
 			}
-		);
+
+			sendFrame(*con, frames, merged);
+			con->endFrame();
+		}
+	);
+
+	hub.logRouter.Deliver(frame.frame_id, frame.logItems);
+	if (frame.stats)
+	{
+		pushStats(hub, *frame.stats);
 	}
 
-	return -2;
+	if (snapshotRequired)
+	{
+		hub.snapshotRequested = true;
+	}
+
+	auto& metrics = Metrics::Get();
+	metrics.sendQueueBytes.Add(sendQueueBytes);
+	metrics.workerFrameNs.Observe(Metrics::NowNs() - start);
+}
+
+bool RelayServer::loadDeflateDictionary(const char *filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	std::string dictionary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (!file.good() && !file.eof())
+	{
+		fprintf(stderr, "could not read deflate dictionary %s\n", filename);
+		return false;
+	}
+	Deflater::SetDictionary(dictionary);
+	return true;
 }
 
-int RelayServer::connectTcpSocket(const char *hostname, const char *port)
+// starts connecting to one of the addresses of hostname, the next one with every attempt
+int RelayServer::connectTcpSocket(const char *hostname, const char *port, unsigned attempt)
 {
 	struct addrinfo hints;
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
 	hints.ai_socktype = SOCK_STREAM; /* Datagram socket */
 
+	// resolving the name still blocks, the connection itself is established in the background
 	struct addrinfo *result;
 	int s = getaddrinfo(hostname, port, &hints, &result);
 	if (s != 0)
 	{
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(s));
-		return s;
+		return -1;
 	}
 
-	struct addrinfo* rp = nullptr;
-	int retval = -1;
-	for (rp=result; rp!=nullptr; rp=rp->ai_next)
+	unsigned count = 0;
+	for (struct addrinfo* rp=result; rp!=nullptr; rp=rp->ai_next)
 	{
-		int fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-		if (fd == -1) { continue; }
+		count++;
+	}
+	struct addrinfo* first = result;
+	for (unsigned i=0; i<attempt%count; i++)
+	{
+		first = first->ai_next;
+	}
 
-		if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+	struct addrinfo* rp = first;
+	int retval = -1;
+	int error = 0;
+	do
+	{
+		int fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK, rp->ai_protocol);
+		if (fd != -1)
+		{
+			if ((connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) || (errno == EINPROGRESS))
+			{
+				retval = fd;
+				break;
+			}
+			error = errno;
+			close(fd);
+		}
+		else
 		{
-			retval = fd;
-			break;
+			error = errno;
 		}
-		close(fd);
+		// wraps around, every address is tried once
+		rp = rp->ai_next ? rp->ai_next : result;
 	}
+	while (rp != first);
 
 	freeaddrinfo(result);
+	if (retval < 0)
+	{
+		fprintf(stderr, "connect to server failed: %s\n", strerror(error));
+	}
 	return retval;
 }
 
+std::string RelayServer::getQueryParameter(const std::string &url, const std::string &name)
+{
+	size_t pos = url.find('?');
+	while (pos != std::string::npos)
+	{
+		size_t start = pos + 1;
+		size_t end = url.find('&', start);
+		size_t eq = url.find('=', start);
+		if ((eq != std::string::npos) && (eq < end) && (url.compare(start, eq-start, name) == 0))
+		{
+			return url.substr(eq+1, (end == std::string::npos) ? std::string::npos : end-eq-1);
+		}
+		pos = end;
+	}
+	return "";
+}
+
+std::string RelayServer::getPath(const std::string &url)
+{
+	size_t end = std::min(url.find('?'), url.size());
+	while ((end > 0) && (url[end-1] == '/'))
+	{
+		end--;
+	}
+	size_t start = 0;
+	while ((start < end) && (url[start] == '/'))
+	{
+		start++;
+	}
+	return url.substr(start, end-start);
+}
+
+namespace
+{
+	// [start, stop) without the spaces and tabs around it
+	void trim(const std::string& s, size_t& start, size_t& stop)
+	{
+		while ((start < stop) && ((s[start] == ' ') || (s[start] == '\t')))
+		{
+			start++;
+		}
+		while ((stop > start) && ((s[stop-1] == ' ') || (s[stop-1] == '\t')))
+		{
+			stop--;
+		}
+	}
+
+	// whether the parameters of a list entry, like ";q=0.5", refuse it with a quality of 0
+	bool refused(const std::string& list, size_t pos, size_t end)
+	{
+		while (pos < end)
+		{
+			size_t stop = std::min(list.find(';', pos), end);
+			size_t start = pos;
+			trim(list, start, stop);
+			if ((stop - start >= 2) && ((list[start] == 'q') || (list[start] == 'Q')) && (list[start+1] == '='))
+			{
+				return strtod(list.substr(start+2, stop-start-2).c_str(), nullptr) <= 0;
+			}
+			pos = stop + 1;
+		}
+		return false;
+	}
+}
+
+bool RelayServer::headerListContains(const std::string &list, const std::string &token)
+{
+	size_t pos = 0;
+	while (pos <= list.size())
+	{
+		size_t end = std::min(list.find(',', pos), list.size());
+		size_t start = pos;
+		size_t stop = std::min(list.find(';', pos), end);
+		trim(list, start, stop);
+		if ((list.compare(start, stop-start, token) == 0) && !refused(list, stop, end)) { return true; }
+		pos = end + 1;
+	}
+	return false;
+}
+
 const char *RelayServer::getEnvOrDefault(const char *envVar, const char *defaultValue)
 {
 	const char* value = getenv(envVar);
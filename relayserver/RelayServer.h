@@ -1,26 +1,138 @@
 #pragma once
 
 #include <uWS.h>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
 #include "TcpProtocol.h"
 #include "WebsocketConnection.h"
+#include "SnapshotCache.h"
+#include "FanoutWorker.h"
+#include "LogRouter.h"
+#include "Room.h"
+#include "StreamRecorder.h"
+#include "StreamReplay.h"
+#include "FrameCoalescer.h"
+#include "Subscription.h"
+
+class EPoll;
 
 class RelayServer
 {
 	public:
-		RelayServer();
 		int Run();
 	private:
-		int _clientSocket;
-		TcpProtocol _tcpProtocol;
-		std::string _statsHTTPResponse;
+		typedef Room::Clock Clock;
+
+		// the first room is the default one, for clients without a room in their URL
+		std::vector<std::unique_ptr<Room>> _rooms;
+		std::vector<std::unique_ptr<FanoutWorker>> _workers;
+		WebsocketConnection::BackpressureLimits _backpressureLimits;
+		bool _permessageDeflate = false;
+		// the default room is recorded, or fed from a recording instead of a gameserver
+		StreamRecorder _recorder;
+		StreamReplay _replay;
+
+		// all pending messages of the current frame, encoded once as a JSON array.
+		// Shared by all rooms, their frames are broadcast one after another.
+		MessageBundle _jsonBundle;
+		std::vector<const MsgPackProtocol::Message*> _jsonMessages;
 
 		static constexpr const char* ENV_GAMESERVER_HOST = "GAMESERVER_HOST";
 		static constexpr const char* ENV_GAMESERVER_HOST_DEFAULT = "localhost";
 		static constexpr const char* ENV_GAMESERVER_PORT = "GAMESERVER_PORT";
 		static constexpr const char* ENV_GAMESERVER_PORT_DEFAULT = "9010";
+		// name=host:port,... one room per gameserver, GAMESERVER_HOST and _PORT are the default room if empty
+		static constexpr const char* ENV_ROOMS = "ROOMS";
+		static constexpr const char* ENV_ROOMS_DEFAULT = "";
 		static constexpr const char* ENV_WEBSOCKET_PORT = "WEBSOCKET_PORT";
 		static constexpr const char* ENV_WEBSOCKET_PORT_DEFAULT = "9009";
+		// number of fan-out threads with their own hub, 0 serves the websockets from the ingest thread
+		static constexpr const char* ENV_WEBSOCKET_THREADS = "WEBSOCKET_THREADS";
+		static constexpr const char* ENV_WEBSOCKET_THREADS_DEFAULT = "0";
+		// a client is behind if more than this many bytes or frames are queued for it
+		static constexpr const char* ENV_SLOW_CLIENT_MAX_BYTES = "SLOW_CLIENT_MAX_BYTES";
+		static constexpr const char* ENV_SLOW_CLIENT_MAX_BYTES_DEFAULT = "4194304";
+		static constexpr const char* ENV_SLOW_CLIENT_MAX_FRAMES = "SLOW_CLIENT_MAX_FRAMES";
+		static constexpr const char* ENV_SLOW_CLIENT_MAX_FRAMES_DEFAULT = "60";
+		// "resync" skips frames until the client caught up and sends a snapshot, "disconnect" closes it
+		static constexpr const char* ENV_SLOW_CLIENT_POLICY = "SLOW_CLIENT_POLICY";
+		static constexpr const char* ENV_SLOW_CLIENT_POLICY_DEFAULT = "resync";
+		// compress shared frames for clients offering permessage-deflate
+		static constexpr const char* ENV_PERMESSAGE_DEFLATE = "PERMESSAGE_DEFLATE";
+		static constexpr const char* ENV_PERMESSAGE_DEFLATE_DEFAULT = "1";
+		// file with the preset dictionary for ?dictionary=1 clients, empty for the built-in one
+		static constexpr const char* ENV_DEFLATE_DICTIONARY = "DEFLATE_DICTIONARY";
+		static constexpr const char* ENV_DEFLATE_DICTIONARY_DEFAULT = "";
+		// records the upstream messages to this file (and an index next to it)
+		static constexpr const char* ENV_RECORD_FILE = "RECORD_FILE";
+		static constexpr const char* ENV_RECORD_FILE_DEFAULT = "";
+		// plays a recording instead of connecting to the gameserver
+		static constexpr const char* ENV_REPLAY_FILE = "REPLAY_FILE";
+		static constexpr const char* ENV_REPLAY_FILE_DEFAULT = "";
+		// 1 is real time, 0 as fast as possible
+		static constexpr const char* ENV_REPLAY_SPEED = "REPLAY_SPEED";
+		static constexpr const char* ENV_REPLAY_SPEED_DEFAULT = "1";
+		static constexpr const char* ENV_REPLAY_START_FRAME = "REPLAY_START_FRAME";
+		static constexpr const char* ENV_REPLAY_START_FRAME_DEFAULT = "0";
+		// other relays can connect here like to a gameserver, one port per room counting up from this one
+		static constexpr const char* ENV_DOWNSTREAM_PORT = "DOWNSTREAM_PORT";
+		static constexpr const char* ENV_DOWNSTREAM_PORT_DEFAULT = "";
+		// JSON with dense ids and interned bot metadata instead of guids (see CompactProtocol.h)
+		static constexpr const char* ENV_COMPACT_JSON = "COMPACT_JSON";
+		static constexpr const char* ENV_COMPACT_JSON_DEFAULT = "0";
+		// the delay before reconnecting to the gameserver doubles with every failed attempt
+		static constexpr const int RECONNECT_DELAY_MIN_MS = 100;
+		static constexpr const int RECONNECT_DELAY_MAX_MS = 5000;
+		static constexpr const int CONNECT_TIMEOUT_MS = 5000;
 		static constexpr const size_t MAX_CLIENT_MESSAGE_SIZE = 10*1024;
-		static int connectTcpSocket(const char* hostname, const char* port);
+		static constexpr const char* HTTP_DEFAULT_RESPONSE = "nope.";
+		static constexpr const char* PATH_STATS = "stats";
+		static constexpr const char* PATH_METRICS = "metrics";
+		static constexpr const char* PATH_DICTIONARY = "dictionary";
+		static constexpr const char* QUERY_TICK_BUNDLE = "bundle";
+		static constexpr const char* QUERY_FORMAT = "format";
+		static constexpr const char* FORMAT_MSGPACK = "msgpack";
+		static constexpr const char* QUERY_DEFLATE_DICTIONARY = "dictionary";
+		// maximum updates per second, skipped frames are merged into the next update
+		static constexpr const char* QUERY_MAX_RATE = "max_rate";
+		// comma separated message types the client wants, all if not given
+		static constexpr const char* QUERY_TYPES = "types";
+
+		typedef std::array<std::unique_ptr<SubscriptionFrames>, FrameCoalescer::RATE_CLASS_COUNT> MergedFrameSets;
+
+		bool setupRooms(const char* rooms, const char* gameserverHost, const char* gameserverPort);
+		void setupRoom(size_t roomIndex);
+		void setupHub(uWS::Hub& h, size_t hubIndex, int extensionOptions, bool viewportsEnabled);
+		void setupRoomGroup(Room& room, uWS::Group<uWS::SERVER>& group, bool viewportsEnabled);
+		Room* findRoom(const std::string& name);
+		void broadcastFrame(Room& room, uWS::Group<uWS::SERVER>& group, uint64_t frame_id, bool resync);
+		void writeJsonFrame(Room& room, MessageBundle& bundle);
+		void sendFrame(WebsocketConnection& con, SubscriptionFrames& frames, MergedFrameSets& merged);
+		void setMaxRate(Room& room, WebsocketConnection& con, double maxRate);
+		void setSubscription(Room& room, WebsocketConnection& con, Subscription::Mask mask);
+		static void countSubscription(Room& room, const WebsocketConnection& con, int delta);
+		void updateCoalescers(Room& room);
+		void pushStats(Room::HubState& hub, const StatsCache::Responses& stats);
+
+		int playReplay(Room& room);
+		int updateUpstream(Room& room, EPoll& epoll);
+		bool handleUpstreamEvent(Room& room, EPoll& epoll);
+		void disconnectUpstream(Room& room, EPoll& epoll);
+		void beginUpstreamFrame(Room& room);
+
+		bool startWorkers(int count, int port, int extensionOptions);
+		void publishFrame(size_t roomIndex, uint64_t frame_id, bool resync, bool statsChanged);
+		void broadcastWorkerFrame(size_t workerIndex, const FrameData& frame, bool resync);
+
+		static bool loadDeflateDictionary(const char* filename);
+		static int connectTcpSocket(const char* hostname, const char* port, unsigned attempt);
+		static std::string getQueryParameter(const std::string& url, const std::string& name);
+		// the URL without the query and the slashes around it
+		static std::string getPath(const std::string& url);
+		// whether a comma separated header value like "json, msgpack" lists token exactly,
+		// entries with parameters (";q=0.5") count unless their quality is 0
+		static bool headerListContains(const std::string& list, const std::string& token);
 		static const char* getEnvOrDefault(const char* envVar, const char* defaultValue);
 };
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+// sequence with O(1) trimming at the back and O(n) prepending of n items,
+// stored in a power of two sized ring. Items are addressed front to back,
+// in memory they form at most two contiguous spans (see span()).
+template <class T>
+class RingBuffer
+{
+	private:
+		template <class Ring, class Value>
+		class basic_iterator
+		{
+			public:
+				typedef std::forward_iterator_tag iterator_category;
+				typedef Value value_type;
+				typedef ptrdiff_t difference_type;
+				typedef Value* pointer;
+				typedef Value& reference;
+
+				basic_iterator(Ring* ring, size_t pos): _ring(ring), _pos(pos) {}
+				reference operator*() const { return (*_ring)[_pos]; }
+				pointer operator->() const { return &(*_ring)[_pos]; }
+				basic_iterator& operator++() { _pos++; return *this; }
+				basic_iterator operator++(int) { basic_iterator it = *this; _pos++; return it; }
+				bool operator==(const basic_iterator& other) const { return _pos == other._pos; }
+				bool operator!=(const basic_iterator& other) const { return _pos != other._pos; }
+
+			private:
+				Ring* _ring;
+				size_t _pos;
+		};
+
+	public:
+		typedef T value_type;
+		typedef basic_iterator<RingBuffer, T> iterator;
+		typedef basic_iterator<const RingBuffer, const T> const_iterator;
+
+		struct Span
+		{
+			const T* data;
+			size_t size;
+		};
+
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		void clear() { _head = 0; _size = 0; }
+
+		T& operator[](size_t i) { return _items[(_head + i) & _mask]; }
+		const T& operator[](size_t i) const { return _items[(_head + i) & _mask]; }
+		T& front() { return (*this)[0]; }
+		const T& front() const { return (*this)[0]; }
+
+		iterator begin() { return iterator(this, 0); }
+		iterator end() { return iterator(this, _size); }
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, _size); }
+
+		// the items front to back are span(0) followed by span(1), the latter may be empty
+		Span span(int n) const
+		{
+			size_t firstSize = std::min(_size, _items.size() - _head);
+			if (n == 0)
+			{
+				return { _items.data() + _head, firstSize };
+			}
+			return { _items.data(), _size - firstSize };
+		}
+
+		void reserve(size_t count)
+		{
+			if (count > _items.size())
+			{
+				grow(count);
+			}
+		}
+
+		// inserts [first, last) in front of the first item, keeping their order
+		template <class InputIt>
+		void prepend(InputIt first, InputIt last)
+		{
+			size_t count = static_cast<size_t>(std::distance(first, last));
+			reserve(_size + count);
+			_head = (_head - count) & _mask;
+			for (size_t pos = _head; first != last; ++first)
+			{
+				_items[pos] = *first;
+				pos = (pos + 1) & _mask;
+			}
+			_size += count;
+		}
+
+		void push_back(const T& item)
+		{
+			reserve(_size + 1);
+			_items[(_head + _size) & _mask] = item;
+			_size++;
+		}
+
+		// shrinking drops items from the back, growing appends default constructed items
+		void resize(size_t count)
+		{
+			if (count <= _size)
+			{
+				_size = count;
+				return;
+			}
+			reserve(count);
+			while (_size < count)
+			{
+				push_back(T());
+			}
+		}
+
+	private:
+		static constexpr const size_t MIN_CAPACITY = 16;
+
+		std::vector<T> _items;
+		size_t _head = 0;
+		size_t _size = 0;
+		size_t _mask = 0;
+
+		void grow(size_t count)
+		{
+			size_t capacity = _items.empty() ? MIN_CAPACITY : _items.size();
+			while (capacity < count)
+			{
+				capacity *= 2;
+			}
+
+			std::vector<T> items(capacity);
+			for (size_t i=0; i<_size; i++)
+			{
+				items[i] = std::move((*this)[i]);
+			}
+			_items.swap(items);
+			_head = 0;
+			_mask = capacity - 1;
+		}
+};
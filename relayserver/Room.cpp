@@ -0,0 +1,33 @@
+#include "Room.h"
+
+Room::Room(const std::string &name, const std::string &host, const std::string &port)
+	: name(name), gameserverHost(host), gameserverPort(port), snapshotCache(tcpProtocol)
+{
+	for (size_t i=0; i<FrameCoalescer::RATE_CLASS_COUNT; i++)
+	{
+		coalescers.push_back(std::make_unique<FrameCoalescer>(FrameCoalescer::GetRate(i)));
+	}
+}
+
+void Room::EnableCompactIds()
+{
+	compactIds = std::make_unique<CompactIds>();
+	snapshotCache.SetCompactIds(compactIds.get());
+	for (auto& coalescer: coalescers)
+	{
+		coalescer->SetCompactIds(compactIds.get());
+	}
+}
+
+Subscription::Mask Room::getSubscriptions(const SubscriberCounts &counts)
+{
+	Subscription::Mask mask = 0;
+	for (size_t i=0; i<Subscription::BIT_COUNT; i++)
+	{
+		if (counts[i].load(std::memory_order_relaxed) > 0)
+		{
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
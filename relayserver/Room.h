@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <uWS.h>
+#include "TcpProtocol.h"
+#include "SnapshotCache.h"
+#include "LogRouter.h"
+#include "FrameCoalescer.h"
+#include "DownstreamServer.h"
+#include "StatsCache.h"
+#include "Subscription.h"
+#include "CompactIds.h"
+
+// one match: the upstream connection to its gameserver with the world state,
+// and the connections watching it. Clients choose a room by the URL path.
+// Every hub has a uWS group per room, so a frame only touches the sockets
+// of its own room. Everything but the per-hub state belongs to the ingest thread.
+struct Room
+{
+	typedef std::chrono::steady_clock Clock;
+	// connections per subscribed message type, by Subscription bit
+	typedef std::array<std::atomic<int>, Subscription::BIT_COUNT> SubscriberCounts;
+
+	typedef enum
+	{
+		UPSTREAM_DISCONNECTED,
+		UPSTREAM_CONNECTING,
+		UPSTREAM_CONNECTED
+	} UpstreamState;
+
+	// the room's connections on one hub, only used on the hub's thread unless noted
+	struct HubState
+	{
+		uWS::Group<uWS::SERVER>* group = nullptr;
+		LogRouter logRouter;
+		// set by a fan-out worker, taken by the ingest thread
+		std::atomic<bool> snapshotRequested{false};
+		// frames of this room might have been dropped, resync with the next one
+		bool resyncPending = false;
+		// streaming /stats requests, each new stats body is written to them
+		std::vector<uWS::HttpResponse*> statsSubscribers;
+	};
+
+	Room(const std::string& name, const std::string& host, const std::string& port);
+	Room(const Room&) = delete;
+	Room& operator=(const Room&) = delete;
+
+	// the message types any JSON connection subscribed to, only these are encoded
+	Subscription::Mask GetJsonSubscriptions() const { return getSubscriptions(jsonSubscribers); }
+	// the message types any connection of the rate class subscribed to, only these are merged into its frames
+	Subscription::Mask GetRateClassSubscriptions(size_t rateClass) const { return getSubscriptions(rateClassSubscribers[rateClass]); }
+	// JSON in the compact format, for all encoders of the room
+	void EnableCompactIds();
+
+	// empty for the default room
+	std::string name;
+	// empty if the room is fed from a recording
+	std::string gameserverHost;
+	std::string gameserverPort;
+
+	int clientSocket = -1;
+	UpstreamState upstreamState = UPSTREAM_DISCONNECTED;
+	// next connection attempt while disconnected, deadline of the attempt while connecting
+	Clock::time_point upstreamTimeout;
+	int reconnectDelayMs = 0;
+	unsigned connectAttempts = 0;
+	// the connections hold state of a previous upstream connection
+	bool upstreamResync = false;
+
+	TcpProtocol tcpProtocol;
+	SnapshotCache snapshotCache;
+	// only present in compact JSON mode
+	std::unique_ptr<CompactIds> compactIds;
+	// relays fed by this room, only present if enabled
+	std::unique_ptr<DownstreamServer> downstream;
+	StatsCache stats;
+	// since the last frame
+	bool statsChanged = false;
+	// streaming /stats requests on all hubs
+	std::atomic<int> statsSubscribers{0};
+
+	// one per rate class, fed on the ingest thread while the class has clients
+	std::vector<std::unique_ptr<FrameCoalescer>> coalescers;
+	bool rateClassDue[FrameCoalescer::RATE_CLASS_COUNT] = {};
+	std::array<std::atomic<int>, FrameCoalescer::RATE_CLASS_COUNT> rateClassClients{};
+	// connections per rate class and subscribed message type, merged frames are encoded in both formats
+	std::array<SubscriberCounts, FrameCoalescer::RATE_CLASS_COUNT> rateClassSubscribers{};
+
+	// connections on all hubs, frames of a room without any are not encoded
+	std::atomic<int> clients{0};
+	// JSON connections per subscribed message type (by Subscription bit), msgpack is passed through as received
+	SubscriberCounts jsonSubscribers{};
+	// index 0 is the ingest thread's hub, or one per fan-out worker
+	std::vector<std::unique_ptr<HubState>> hubs;
+
+private:
+	static Subscription::Mask getSubscriptions(const SubscriberCounts& counts);
+};
@@ -0,0 +1,82 @@
+#include "SnapshotCache.h"
+#include "TcpProtocol.h"
+#include "JsonProtocol.h"
+#include "CompactProtocol.h"
+
+SnapshotCache::SnapshotCache(const TcpProtocol &proto)
+	: _proto(proto)
+{
+}
+
+PreparedFrame& SnapshotCache::Get(Format format, uint64_t frame_id, PreparedFrame::Compression compression)
+{
+	auto& bundle = GetBundle(format, frame_id);
+	auto& frame = _entries[format].frames[compression];
+	if (!frame)
+	{
+		frame = std::make_unique<PreparedFrame>(bundle, GetOpCode(format), false, compression);
+	}
+	return *frame;
+}
+
+const MessageBundle& SnapshotCache::GetBundle(Format format, uint64_t frame_id)
+{
+	auto& entry = _entries[format];
+	if (!entry.valid || (entry.frame_id != frame_id))
+	{
+		// release the frames of the previous snapshot before its buffer is reused
+		for (auto& frame: entry.frames)
+		{
+			frame.reset();
+		}
+		entry.bundle.clear();
+		encode(format, entry.bundle);
+		entry.frame_id = frame_id;
+		entry.valid = true;
+	}
+	return entry.bundle;
+}
+
+void SnapshotCache::Invalidate()
+{
+	for (auto& entry: _entries)
+	{
+		entry.valid = false;
+	}
+}
+
+uWS::OpCode SnapshotCache::GetOpCode(Format format)
+{
+	return (format == FORMAT_MSGPACK) ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+}
+
+void SnapshotCache::encode(Format format, MessageBundle &bundle)
+{
+	auto& data = bundle.data;
+	if (format == FORMAT_MSGPACK)
+	{
+		msgpack::sbuffer buf;
+		MsgPackProtocol::pack(buf, _proto.GetGameInfo());
+		bundle.items.emplace_back(0, buf.size());
+		_proto.PackWorldUpdate(buf);
+		bundle.items.emplace_back(bundle.items[0].second, buf.size() - bundle.items[0].second);
+		data.assign(buf.data(), buf.size());
+	}
+	else
+	{
+		JsonWriter gameInfoWriter(data);
+		to_json(gameInfoWriter, _proto.GetGameInfo());
+		bundle.items.emplace_back(0, data.size());
+
+		JsonWriter worldUpdateWriter(data);
+		if (_compactIds)
+		{
+			CompactProtocol::writeWorldUpdate(worldUpdateWriter, _proto, *_compactIds);
+		}
+		else
+		{
+			_proto.WriteWorldUpdate(worldUpdateWriter);
+		}
+		bundle.items.emplace_back(bundle.items[0].second, data.size() - bundle.items[0].second);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include "MessageBundle.h"
+#include "PreparedFrame.h"
+#include "CompactIds.h"
+
+class TcpProtocol;
+
+// GameInfo and WorldUpdate messages for new connections, encoded at most
+// once per frame and format and shared by all connections joining in that frame
+class SnapshotCache
+{
+	public:
+		typedef enum
+		{
+			FORMAT_JSON,
+			FORMAT_MSGPACK,
+			FORMAT_COUNT
+		} Format;
+
+		SnapshotCache(const TcpProtocol& proto);
+		PreparedFrame& Get(Format format, uint64_t frame_id, PreparedFrame::Compression compression);
+		const MessageBundle& GetBundle(Format format, uint64_t frame_id);
+		// frame ids start over with a new upstream connection
+		void Invalidate();
+		// JSON in the compact format, nullptr for the regular one
+		void SetCompactIds(const CompactIds* ids) { _compactIds = ids; }
+		static uWS::OpCode GetOpCode(Format format);
+
+	private:
+		struct Entry
+		{
+			bool valid = false;
+			uint64_t frame_id = 0;
+			MessageBundle bundle;
+			std::unique_ptr<PreparedFrame> frames[PreparedFrame::COMPRESSION_COUNT];
+		};
+
+		const TcpProtocol& _proto;
+		const CompactIds* _compactIds = nullptr;
+		Entry _entries[FORMAT_COUNT];
+
+		void encode(Format format, MessageBundle& bundle);
+};
@@ -0,0 +1,99 @@
+#include "SpatialGrid.h"
+#include <math.h>
+
+void SpatialGrid::SetWorldSize(real_t worldSizeX, real_t worldSizeY)
+{
+	_worldSizeX = worldSizeX;
+	_worldSizeY = worldSizeY;
+
+	_cellsX = cellCount(worldSizeX);
+	_cellsY = cellCount(worldSizeY);
+	_cellSizeX = (worldSizeX > 0) ? worldSizeX / _cellsX : INFINITY;
+	_cellSizeY = (worldSizeY > 0) ? worldSizeY / _cellsY : INFINITY;
+	Clear();
+}
+
+void SpatialGrid::Clear()
+{
+	_pending.clear();
+	_values.clear();
+	_cellStart.assign(_cellsX * _cellsY + 1, 0);
+}
+
+void SpatialGrid::Add(const Vector2D &pos, uint32_t value)
+{
+	size_t cell = wrap(cellIndex(pos.y(), _cellSizeY), _cellsY) * _cellsX + wrap(cellIndex(pos.x(), _cellSizeX), _cellsX);
+	_pending.emplace_back(static_cast<uint32_t>(cell), value);
+}
+
+void SpatialGrid::Build()
+{
+	// counting sort by cell
+	_cellStart.assign(_cellsX * _cellsY + 1, 0);
+	for (auto& entry: _pending)
+	{
+		_cellStart[entry.first + 1]++;
+	}
+	for (size_t i=1; i<_cellStart.size(); i++)
+	{
+		_cellStart[i] += _cellStart[i-1];
+	}
+
+	_values.resize(_pending.size());
+	std::vector<uint32_t> next(_cellStart.begin(), _cellStart.end() - 1);
+	for (auto& entry: _pending)
+	{
+		_values[next[entry.first]++] = entry.second;
+	}
+	_pending.clear();
+}
+
+bool SpatialGrid::Contains(const Rect &rect, const Vector2D &pos) const
+{
+	real_t dx = offset(pos.x(), rect.x, _worldSizeX);
+	real_t dy = offset(pos.y(), rect.y, _worldSizeY);
+	return (dx >= 0) && (dx <= rect.width) && (dy >= 0) && (dy <= rect.height);
+}
+
+bool SpatialGrid::Contains(const Rect &outer, const Rect &inner) const
+{
+	real_t dx = offset(inner.x, outer.x, _worldSizeX);
+	real_t dy = offset(inner.y, outer.y, _worldSizeY);
+	return (dx >= 0) && (dx + inner.width <= outer.width) && (dy >= 0) && (dy + inner.height <= outer.height);
+}
+
+size_t SpatialGrid::cellCount(real_t worldSize)
+{
+	// without a known world size everything goes into a single cell
+	if (!(worldSize > 0)) { return 1; }
+
+	size_t count = static_cast<size_t>(ceil(worldSize / CELL_SIZE));
+	if (count < 1) { count = 1; }
+	if (count > MAX_CELLS_PER_AXIS) { count = MAX_CELLS_PER_AXIS; }
+	return count;
+}
+
+int SpatialGrid::cellIndex(real_t coord, real_t cellSize)
+{
+	// clamped, rects come from clients
+	real_t index = floor(coord / cellSize);
+	return static_cast<int>(std::max(std::min(index, real_t(1e8)), real_t(-1e8)));
+}
+
+size_t SpatialGrid::wrap(int index, size_t count)
+{
+	int n = static_cast<int>(count);
+	return static_cast<size_t>(((index % n) + n) % n);
+}
+
+// distance from origin to coord going in positive direction around the world
+real_t SpatialGrid::offset(real_t coord, real_t origin, real_t worldSize)
+{
+	real_t d = coord - origin;
+	if (worldSize > 0)
+	{
+		d = fmod(d, worldSize);
+		if (d < 0) { d += worldSize; }
+	}
+	return d;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "types.h"
+
+// uniform grid over the wrapping world. The indexed values of one cell are
+// stored contiguously; the grid is rebuilt from scratch (Clear(), Add(),
+// Build()) rather than updated, which is cheaper for positions that all
+// change every frame.
+class SpatialGrid
+{
+	public:
+		static constexpr const real_t CELL_SIZE = 128;
+		static constexpr const size_t MAX_CELLS_PER_AXIS = 256;
+
+		// top left corner and size, may extend beyond the world borders
+		struct Rect
+		{
+			real_t x;
+			real_t y;
+			real_t width;
+			real_t height;
+		};
+
+		void SetWorldSize(real_t worldSizeX, real_t worldSizeY);
+		void Clear();
+		void Add(const Vector2D& pos, uint32_t value);
+		void Build();
+
+		// calls callback(value) for all values in the cells overlapping rect,
+		// the caller has to check the exact position with Contains()
+		template <class F>
+		void Query(const Rect& rect, F callback) const
+		{
+			int x0 = cellIndex(rect.x, _cellSizeX);
+			int y0 = cellIndex(rect.y, _cellSizeY);
+			size_t countX = std::min(static_cast<size_t>(cellIndex(rect.x + rect.width, _cellSizeX) - x0 + 1), _cellsX);
+			size_t countY = std::min(static_cast<size_t>(cellIndex(rect.y + rect.height, _cellSizeY) - y0 + 1), _cellsY);
+
+			for (size_t j=0; j<countY; j++)
+			{
+				size_t row = wrap(y0 + static_cast<int>(j), _cellsY) * _cellsX;
+				for (size_t i=0; i<countX; i++)
+				{
+					size_t cell = row + wrap(x0 + static_cast<int>(i), _cellsX);
+					for (uint32_t k=_cellStart[cell]; k<_cellStart[cell+1]; k++)
+					{
+						callback(_values[k]);
+					}
+				}
+			}
+		}
+
+		bool Contains(const Rect& rect, const Vector2D& pos) const;
+		bool Contains(const Rect& outer, const Rect& inner) const;
+
+	private:
+		real_t _worldSizeX = 0;
+		real_t _worldSizeY = 0;
+		real_t _cellSizeX = CELL_SIZE;
+		real_t _cellSizeY = CELL_SIZE;
+		size_t _cellsX = 1;
+		size_t _cellsY = 1;
+
+		std::vector<uint32_t> _cellStart;
+		std::vector<uint32_t> _values;
+		std::vector<std::pair<uint32_t, uint32_t>> _pending; // cell, value
+
+		static size_t cellCount(real_t worldSize);
+		static int cellIndex(real_t coord, real_t cellSize);
+		static size_t wrap(int index, size_t count);
+		static real_t offset(real_t coord, real_t origin, real_t worldSize);
+};
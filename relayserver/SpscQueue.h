@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+// bounded lock-free queue for exactly one producer and one consumer thread
+template <class T>
+class SpscQueue
+{
+	public:
+		// capacity is rounded up to a power of two
+		explicit SpscQueue(size_t capacity)
+		{
+			size_t size = 1;
+			while (size < capacity)
+			{
+				size *= 2;
+			}
+			_items.resize(size);
+			_mask = size - 1;
+		}
+
+		// producer only, fails if the queue is full
+		bool push(T item)
+		{
+			size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head.load(std::memory_order_acquire) == _items.size())
+			{
+				return false;
+			}
+			_items[tail & _mask] = std::move(item);
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer only, fails if the queue is empty
+		bool pop(T& item)
+		{
+			size_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			item = std::move(_items[head & _mask]);
+			_items[head & _mask] = T();
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// approximate when called from other threads
+		size_t size() const
+		{
+			return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::vector<T> _items;
+		size_t _mask;
+		alignas(64) std::atomic<size_t> _head{0};
+		alignas(64) std::atomic<size_t> _tail{0};
+};
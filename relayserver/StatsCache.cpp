@@ -0,0 +1,84 @@
+#include "StatsCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include "JsonProtocol.h"
+
+bool StatsCache::Update(const MsgPackProtocol::BotStatsMessage &msg)
+{
+	std::string content;
+	JsonWriter writer(content);
+	to_json(writer, msg);
+	if (_content == content) { return false; }
+	_content = content;
+
+	// FNV-1a of the body, so the tag survives restarts and identical updates
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c: content)
+	{
+		hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+	}
+	char etag[32];
+	snprintf(etag, sizeof(etag), "\"%016llx\"", static_cast<unsigned long long>(hash));
+
+	auto responses = std::make_shared<Responses>();
+	responses->etag = etag;
+	responses->identity = makeResponse(responses->etag, content, nullptr);
+	std::string compressed;
+	responses->gzip = gzip(content, compressed) ? makeResponse(responses->etag, compressed, "gzip") : responses->identity;
+	responses->notModified = "HTTP/1.1 304 Not Modified\r\nETag: " + responses->etag + "\r\nCache-Control: no-cache\r\nVary: Accept-Encoding\r\n\r\n";
+	responses->event = "id: " + responses->etag.substr(1, responses->etag.size()-2) + "\ndata: " + content + "\n\n";
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_current = std::move(responses);
+	return true;
+}
+
+std::shared_ptr<const StatsCache::Responses> StatsCache::Get() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _current;
+}
+
+const std::string& StatsCache::GetEventStreamHeader()
+{
+	static const std::string header =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/event-stream; charset=UTF-8\r\n"
+		"Cache-Control: no-cache\r\n\r\n";
+	return header;
+}
+
+bool StatsCache::gzip(const std::string &data, std::string &out)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	// 16 added to the window bits: gzip header and trailer instead of zlib's
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { return false; }
+
+	out.resize(deflateBound(&stream, data.size()));
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	stream.avail_out = static_cast<uInt>(out.size());
+	int result = deflate(&stream, Z_FINISH);
+	out.resize(stream.total_out);
+	deflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+
+std::string StatsCache::makeResponse(const std::string &etag, const std::string &body, const char *contentEncoding)
+{
+	std::string response = "HTTP/1.1 200 OK\r\n";
+	response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	response += "Content-Type: application/json; charset=UTF-8\r\n";
+	if (contentEncoding)
+	{
+		response += std::string("Content-Encoding: ") + contentEncoding + "\r\n";
+	}
+	response += "ETag: " + etag + "\r\n";
+	response += "Cache-Control: no-cache\r\n";
+	response += "Vary: Accept-Encoding\r\n\r\n";
+	response += body;
+	return response;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "MsgPackProtocol.h"
+
+// the /stats responses of one room, encoded once per BotStats message and
+// shared by every request on every thread. A stats message with the same
+// content as the previous one changes nothing, so its ETag stays valid.
+class StatsCache
+{
+	public:
+		// complete HTTP responses (and the event for streaming subscribers), immutable once published
+		struct Responses
+		{
+			// quoted, as in the ETag and If-None-Match headers
+			std::string etag;
+			std::string identity;
+			std::string gzip;
+			std::string notModified;
+			std::string event;
+		};
+
+		// ingest thread, false if the content did not change
+		bool Update(const MsgPackProtocol::BotStatsMessage& msg);
+		// any thread, nullptr until the first stats message
+		std::shared_ptr<const Responses> Get() const;
+
+		// headers of the streaming variant, followed by one event per update
+		static const std::string& GetEventStreamHeader();
+
+	private:
+		mutable std::mutex _mutex;
+		std::shared_ptr<const Responses> _current;
+		std::string _content;
+
+		static bool gzip(const std::string& data, std::string& out);
+		static std::string makeResponse(const std::string& etag, const std::string& body, const char* contentEncoding);
+};
@@ -0,0 +1,68 @@
+#include "StreamRecorder.h"
+
+StreamRecorder::~StreamRecorder()
+{
+	close();
+}
+
+bool StreamRecorder::Open(const std::string &filename)
+{
+	close();
+	_data = fopen(filename.c_str(), "wb");
+	if (!_data)
+	{
+		perror("could not open recording");
+		return false;
+	}
+	std::string indexFilename = filename + INDEX_SUFFIX;
+	_index = fopen(indexFilename.c_str(), "wb");
+	if (!_index)
+	{
+		perror("could not open recording index");
+		close();
+		return false;
+	}
+	_offset = 0;
+	_start = std::chrono::steady_clock::now();
+	return true;
+}
+
+void StreamRecorder::Write(const char *data, size_t size)
+{
+	if (!_data) { return; }
+	if (fwrite(data, 1, size, _data) != size)
+	{
+		perror("writing recording failed");
+		close();
+		return;
+	}
+	_offset += size;
+}
+
+void StreamRecorder::MarkFrame(uint64_t frame_id)
+{
+	if (!_index) { return; }
+	auto elapsed = std::chrono::steady_clock::now() - _start;
+	IndexEntry entry { frame_id, _offset, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()) };
+
+	// flushed once per frame, so an interrupted recording stays usable up to the last complete frame
+	if ((fflush(_data) != 0) || (fwrite(&entry, sizeof(entry), 1, _index) != 1) || (fflush(_index) != 0))
+	{
+		perror("writing recording failed");
+		close();
+	}
+}
+
+void StreamRecorder::close()
+{
+	if (_data)
+	{
+		fclose(_data);
+		_data = nullptr;
+	}
+	if (_index)
+	{
+		fclose(_index);
+		_index = nullptr;
+	}
+}
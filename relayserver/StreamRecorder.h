@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+
+// appends the upstream messages, exactly as received (length prefix
+// included), to a file. A second file (filename + INDEX_SUFFIX) gets one
+// IndexEntry per frame, so StreamReplay can seek and keep the original pace.
+class StreamRecorder
+{
+	public:
+		struct IndexEntry
+		{
+			uint64_t frame_id;
+			// end of the frame's Tick message in the data file
+			uint64_t offset;
+			// since the start of the recording
+			uint64_t time_us;
+		};
+
+		static constexpr const char* INDEX_SUFFIX = ".index";
+
+		StreamRecorder() = default;
+		~StreamRecorder();
+		StreamRecorder(const StreamRecorder&) = delete;
+		StreamRecorder& operator=(const StreamRecorder&) = delete;
+
+		// truncates existing files
+		bool Open(const std::string& filename);
+		bool IsOpen() const { return _data != nullptr; }
+		void Write(const char* data, size_t size);
+		// called once the frame's Tick message was written
+		void MarkFrame(uint64_t frame_id);
+
+	private:
+		FILE* _data = nullptr;
+		FILE* _index = nullptr;
+		uint64_t _offset = 0;
+		std::chrono::steady_clock::time_point _start;
+
+		void close();
+};
@@ -0,0 +1,162 @@
+#include "StreamReplay.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "TcpProtocol.h"
+
+StreamReplay::~StreamReplay()
+{
+	close();
+}
+
+bool StreamReplay::Open(const std::string &filename)
+{
+	close();
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		perror("could not open recording");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		perror("could not stat recording");
+		::close(fd);
+		return false;
+	}
+	_size = static_cast<size_t>(st.st_size);
+	void* data = (_size > 0) ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		perror("could not map recording");
+		_size = 0;
+		return false;
+	}
+	_data = static_cast<const char*>(data);
+	madvise(data, _size, MADV_SEQUENTIAL);
+
+	std::string indexFilename = filename + StreamRecorder::INDEX_SUFFIX;
+	FILE* index = fopen(indexFilename.c_str(), "rb");
+	if (!index)
+	{
+		perror("could not open recording index");
+		close();
+		return false;
+	}
+	StreamRecorder::IndexEntry entry;
+	uint64_t lastOffset = 0;
+	while (fread(&entry, sizeof(entry), 1, index) == 1)
+	{
+		// the data of an interrupted recording might end before its index
+		if ((entry.offset < lastOffset) || (entry.offset > _size)) { break; }
+		_index.push_back(entry);
+		lastOffset = entry.offset;
+	}
+	fclose(index);
+
+	fprintf(stderr, "replaying %zu frames from %s\n", _index.size(), filename.c_str());
+	return Seek(0);
+}
+
+bool StreamReplay::Seek(uint64_t frame_id)
+{
+	auto it = std::lower_bound(_index.begin(), _index.end(), frame_id,
+		[](const StreamRecorder::IndexEntry& entry, uint64_t id) { return entry.frame_id < id; });
+	_next = static_cast<size_t>(it - _index.begin());
+	_started = false;
+	_keyframePending = false;
+	if ((_next > 0) && (_next < _index.size()))
+	{
+		if (!makeKeyframe(frameStart(_next))) { return false; }
+		_keyframePending = true;
+	}
+	return true;
+}
+
+int StreamReplay::GetTimeout() const
+{
+	if (_keyframePending) { return 0; }
+	if (_next >= _index.size()) { return -1; }
+	if (!_started || (_speed <= 0)) { return 0; }
+
+	auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(dueTime(_next) - std::chrono::steady_clock::now()).count();
+	return (remaining > 0) ? static_cast<int>((remaining + 999) / 1000) : 0;
+}
+
+bool StreamReplay::NextFrame(const char *&data, size_t &size)
+{
+	if (!_started && (_keyframePending || (_next < _index.size())))
+	{
+		_started = true;
+		_startTime = std::chrono::steady_clock::now();
+		_startTimeUs = _index[(_next > 0) ? _next-1 : 0].time_us;
+	}
+
+	if (_keyframePending)
+	{
+		_keyframePending = false;
+		data = _keyframe.data();
+		size = _keyframe.size();
+		return true;
+	}
+	if (_next >= _index.size()) { return false; }
+
+	size_t start = frameStart(_next);
+	data = _data + start;
+	size = _index[_next].offset - start;
+	_next++;
+	return true;
+}
+
+std::chrono::steady_clock::time_point StreamReplay::dueTime(size_t entry) const
+{
+	double elapsedUs = static_cast<double>(_index[entry].time_us - _startTimeUs) / _speed;
+	return _startTime + std::chrono::microseconds(static_cast<int64_t>(elapsedUs));
+}
+
+// the world state at end, from replaying everything before it
+bool StreamReplay::makeKeyframe(size_t end)
+{
+	TcpProtocol proto;
+	proto.SetFrameCompleteCallback([&proto](uint64_t frame_id) { proto.ClearLogItems(); });
+	if (!proto.Process(_data, end))
+	{
+		fprintf(stderr, "recording is corrupt\n");
+		return false;
+	}
+
+	msgpack::sbuffer gameInfo;
+	MsgPackProtocol::pack(gameInfo, proto.GetGameInfo());
+	msgpack::sbuffer worldUpdate;
+	proto.PackWorldUpdate(worldUpdate);
+
+	_keyframe.clear();
+	for (auto* buf: { &gameInfo, &worldUpdate })
+	{
+		uint32_t length = htonl(static_cast<uint32_t>(buf->size()));
+		_keyframe.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		_keyframe.append(buf->data(), buf->size());
+	}
+	return true;
+}
+
+void StreamReplay::close()
+{
+	if (_data)
+	{
+		munmap(const_cast<char*>(_data), _size);
+		_data = nullptr;
+	}
+	_size = 0;
+	_index.clear();
+	_next = 0;
+	_keyframePending = false;
+	_started = false;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "StreamRecorder.h"
+
+// plays back a recording made by StreamRecorder. The data file is mmapped
+// and handed out frame by frame, in the original length-prefixed format, at
+// the recorded pace times the speed factor.
+class StreamReplay
+{
+	public:
+		StreamReplay() = default;
+		~StreamReplay();
+		StreamReplay(const StreamReplay&) = delete;
+		StreamReplay& operator=(const StreamReplay&) = delete;
+
+		bool Open(const std::string& filename);
+		// 1 plays in real time, 2 twice as fast, 0 as fast as possible
+		void SetSpeed(double speed) { _speed = speed; }
+		// starts over with the first recorded frame with an id >= frame_id. If that is not the
+		// first frame, the state before it is sent as GameInfo and WorldUpdate first.
+		bool Seek(uint64_t frame_id);
+		// milliseconds until the next frame is due, -1 at the end of the recording
+		int GetTimeout() const;
+		// the messages of the next frame, regardless of whether it is due yet. false at the end.
+		bool NextFrame(const char*& data, size_t& size);
+		size_t GetFrameCount() const { return _index.size(); }
+
+	private:
+		const char* _data = nullptr;
+		size_t _size = 0;
+		std::vector<StreamRecorder::IndexEntry> _index;
+		double _speed = 1;
+
+		// index entry of the next frame, the frame data starts at the end of the previous one
+		size_t _next = 0;
+		std::string _keyframe;
+		bool _keyframePending = false;
+		bool _started = false;
+		std::chrono::steady_clock::time_point _startTime;
+		uint64_t _startTimeUs = 0;
+
+		size_t frameStart(size_t entry) const { return (entry == 0) ? 0 : _index[entry-1].offset; }
+		std::chrono::steady_clock::time_point dueTime(size_t entry) const;
+		bool makeKeyframe(size_t end);
+		void close();
+};
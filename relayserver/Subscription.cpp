@@ -0,0 +1,116 @@
+#include "Subscription.h"
+#include <algorithm>
+#include "MsgPackProtocol.h"
+
+Subscription::Mask Subscription::GetBit(uint64_t messageType)
+{
+	switch (messageType)
+	{
+		case MsgPackProtocol::MESSAGE_TYPE_GAME_INFO: return 1u << 0;
+		case MsgPackProtocol::MESSAGE_TYPE_WORLD_UPDATE: return 1u << 1;
+		case MsgPackProtocol::MESSAGE_TYPE_TICK: return 1u << 2;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_SPAWN: return 1u << 3;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_KILL: return 1u << 4;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE: return 1u << 5;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_LOG: return 1u << 6;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_STATS: return 1u << 7;
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD: return 1u << 8;
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_SPAWN: return 1u << 9;
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_CONSUME: return 1u << 10;
+		case MsgPackProtocol::MESSAGE_TYPE_FOOD_DECAY: return 1u << 11;
+		case MsgPackProtocol::MESSAGE_TYPE_PLAYER_INFO: return 1u << 12;
+	}
+	return ALL;
+}
+
+bool Subscription::Parse(const std::string &names, Mask &mask)
+{
+	mask = REQUIRED;
+	size_t start = 0;
+	while (start < names.size())
+	{
+		size_t end = std::min(names.find(',', start), names.size());
+		std::string name = names.substr(start, end-start);
+		start = end + 1;
+
+		Mask bit = 0;
+		for (uint64_t type=0; type<256; type++)
+		{
+			const char* typeName = MsgPackProtocol::messageTypeName(type);
+			if (typeName && (name == typeName))
+			{
+				bit = GetBit(type);
+				break;
+			}
+		}
+		if (bit == 0) { return false; }
+		mask |= bit;
+	}
+	return true;
+}
+
+void Subscription::Filter(const MessageBundle &in, Mask mask, bool jsonArray, MessageBundle &out)
+{
+	out.clear();
+	if (jsonArray)
+	{
+		out.data.push_back('[');
+	}
+	for (size_t i=0; i<in.items.size(); i++)
+	{
+		// bundles without types are passed on completely
+		bool typed = (i < in.types.size());
+		if (typed && !(GetBit(in.types[i]) & mask)) { continue; }
+
+		if (jsonArray && !out.items.empty())
+		{
+			out.data.push_back(',');
+		}
+		size_t pos = out.data.size();
+		out.data.append(in.data, in.items[i].first, in.items[i].second);
+		out.items.emplace_back(pos, in.items[i].second);
+		if (typed)
+		{
+			out.types.push_back(in.types[i]);
+		}
+	}
+	if (jsonArray)
+	{
+		out.data.push_back(']');
+	}
+}
+
+SubscriptionFrames::SubscriptionFrames(const MessageBundle &json, const MessageBundle &msgpack)
+	: _json(json), _msgpack(msgpack), _all(json, msgpack)
+{
+}
+
+PreparedFrameSet& SubscriptionFrames::Get(Subscription::Mask mask, bool msgPack)
+{
+	if ((mask & Subscription::ALL) == Subscription::ALL) { return _all; }
+
+	Class* subscriptionClass = nullptr;
+	for (auto& c: _classes)
+	{
+		if (c->mask == mask)
+		{
+			subscriptionClass = c.get();
+			break;
+		}
+	}
+	if (!subscriptionClass)
+	{
+		_classes.push_back(std::make_unique<Class>());
+		subscriptionClass = _classes.back().get();
+		subscriptionClass->mask = mask;
+		subscriptionClass->frames = std::make_unique<PreparedFrameSet>(subscriptionClass->json, subscriptionClass->msgpack);
+	}
+
+	if (!subscriptionClass->filtered[msgPack])
+	{
+		auto& out = msgPack ? subscriptionClass->msgpack : subscriptionClass->json;
+		Subscription::Filter(msgPack ? _msgpack : _json, mask, !msgPack, out);
+		subscriptionClass->filtered[msgPack] = true;
+	}
+	return *subscriptionClass->frames;
+}
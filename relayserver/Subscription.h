@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MessageBundle.h"
+#include "PreparedFrame.h"
+
+// the message types a client wants to receive, as a bit mask. Connections
+// with the same mask form a subscription class, which shares its frames.
+namespace Subscription
+{
+	typedef uint32_t Mask;
+
+	static constexpr const size_t BIT_COUNT = 13;
+	static constexpr const Mask ALL = (1u << BIT_COUNT) - 1;
+	// GameInfo, WorldUpdate and Tick are needed to follow the game at all, they are part of every subscription
+	static constexpr const Mask REQUIRED = 0x7;
+
+	// bit of a message type, unknown types are in every subscription
+	Mask GetBit(uint64_t messageType);
+	// comma separated JSON type names, e.g. "Tick,BotSpawn,BotKill,BotMoveHead". False if one is unknown.
+	bool Parse(const std::string& names, Mask& mask);
+	// copies the items of the types in mask, keeping the JSON array around them for tick bundles
+	void Filter(const MessageBundle& in, Mask mask, bool jsonArray, MessageBundle& out);
+}
+
+// the shared frames of each subscription class, each class' variant of a
+// format is filtered from the full frame when its first connection needs it
+class SubscriptionFrames
+{
+	public:
+		SubscriptionFrames(const MessageBundle& json, const MessageBundle& msgpack);
+		SubscriptionFrames(const SubscriptionFrames&) = delete;
+		SubscriptionFrames& operator=(const SubscriptionFrames&) = delete;
+
+		PreparedFrameSet& Get(Subscription::Mask mask, bool msgPack);
+
+	private:
+		struct Class
+		{
+			Subscription::Mask mask;
+			MessageBundle json;
+			MessageBundle msgpack;
+			bool filtered[2] = {};
+			std::unique_ptr<PreparedFrameSet> frames;
+		};
+
+		const MessageBundle& _json;
+		const MessageBundle& _msgpack;
+		PreparedFrameSet _all;
+		std::vector<std::unique_ptr<Class>> _classes;
+};
@@ -1,14 +1,19 @@
 #include "TcpProtocol.h"
+#include "JsonProtocol.h"
 #include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 #include <array>
 #include <algorithm>
 #include <msgpack.hpp>
 #include <iostream>
 
 TcpProtocol::TcpProtocol()
+	: _zone(ZONE_CHUNK_SIZE)
 {
-	_buf.resize(BUFFER_SIZE);
 }
 
 void TcpProtocol::SetFrameCompleteCallback(TcpProtocol::FrameCompleteCallback callback)
@@ -21,142 +26,420 @@ void TcpProtocol::SetStatsReceivedCallback(StatsReceivedCallback callback)
 	_statsReceivedCallback = callback;
 }
 
+void TcpProtocol::SetRawMessageCallback(RawMessageCallback callback)
+{
+	_rawMessageCallback = callback;
+}
+
 bool TcpProtocol::Read(int socket)
-{	
-	ssize_t bytesRead = read(socket, &_buf[_bufTail], _buf.size()-_bufTail);
+{
+	while (true)
+	{
+		if (_buf.size() - _bufTail < MIN_READ_SIZE)
+		{
+			MakeRoom(MIN_READ_SIZE);
+		}
+
+		size_t space = _buf.size() - _bufTail;
+		ssize_t bytesRead = read(socket, &_buf[_bufTail], space);
+		if (bytesRead < 0)
+		{
+			if (errno == EINTR) { continue; }
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+		if (bytesRead == 0) { return false; }
 
-	if (bytesRead<=0) { return false; }
-	_bufTail += static_cast<size_t>(bytesRead);
+		_bufTail += static_cast<size_t>(bytesRead);
+		_bufferStatistics.bufferedBytesHighWater = std::max(_bufferStatistics.bufferedBytesHighWater, _bufTail - _bufHead);
 
+		if (!ProcessBuffer()) { return false; }
+
+		// a short read means the socket is drained, no need for another syscall to find out
+		if (static_cast<size_t>(bytesRead) < space) { return true; }
+	}
+}
+
+bool TcpProtocol::ProcessBuffer()
+{
 	while ((_bufTail - _bufHead)>=4)
 	{
-		size_t size = 4 + ntohl(*(reinterpret_cast<uint32_t*>(&_buf[_bufHead])));
-		if (size > _buf.size()) { return false; }
-		if (size <= (_bufTail - _bufHead))
+		uint32_t length;
+		memcpy(&length, &_buf[_bufHead], sizeof(length));
+		size_t size = 4 + ntohl(length);
+		if (size > MAX_MESSAGE_SIZE)
 		{
-			OnMessageReceived(&_buf[_bufHead+4], size-4);
-			_bufHead += size;
+			fprintf(stderr, "message of %zu bytes exceeds maximum message size\n", size);
+			return false;
 		}
-		else
+		_bufferStatistics.messageSizeHighWater = std::max(_bufferStatistics.messageSizeHighWater, size);
+
+		if (size > (_bufTail - _bufHead))
 		{
+			// incomplete message: make sure the rest of it fits into the buffer
+			if (_bufHead + size > _buf.size())
+			{
+				MakeRoom(size - (_bufTail - _bufHead));
+			}
 			break;
 		}
+
+		ReceiveMessage(&_buf[_bufHead], size);
+		_bufHead += size;
 	}
 
-	std::copy(_buf.begin()+_bufHead, _buf.begin()+_bufTail, _buf.begin());
-	_bufTail -= _bufHead;
-	_bufHead = 0;
+	if (_bufHead == _bufTail)
+	{
+		_bufHead = 0;
+		_bufTail = 0;
+	}
 	return true;
 }
 
+bool TcpProtocol::Process(const char *data, size_t size)
+{
+	while (size >= 4)
+	{
+		uint32_t length;
+		memcpy(&length, data, sizeof(length));
+		size_t messageSize = 4 + ntohl(length);
+		if (messageSize > size)
+		{
+			fprintf(stderr, "incomplete message of %zu bytes\n", messageSize);
+			return false;
+		}
+
+		ReceiveMessage(data, messageSize);
+		data += messageSize;
+		size -= messageSize;
+	}
+	return (size == 0);
+}
+
+void TcpProtocol::MakeRoom(size_t required)
+{
+	size_t used = _bufTail - _bufHead;
+	if (_bufHead > 0)
+	{
+		memmove(&_buf[0], &_buf[_bufHead], used);
+		_bufHead = 0;
+		_bufTail = used;
+		_bufferStatistics.compactCount++;
+	}
+
+	if (_buf.size() - _bufTail < required)
+	{
+		// allocated with the first read, so rooms without an upstream connection need no buffer
+		size_t newSize = _buf.empty() ? BUFFER_SIZE : _buf.size();
+		while (newSize - used < required)
+		{
+			newSize *= 2;
+		}
+		if (!_buf.empty())
+		{
+			fprintf(stderr, "growing receive buffer from %zu to %zu bytes\n", _buf.size(), newSize);
+			_bufferStatistics.bufferGrowCount++;
+		}
+		_buf.resize(newSize);
+		_bufferStatistics.bufferSize = newSize;
+	}
+}
+
 std::unique_ptr<MsgPackProtocol::WorldUpdateMessage> TcpProtocol::MakeWorldUpdateMessage() const
 {
 	auto result = std::make_unique<MsgPackProtocol::WorldUpdateMessage>();
 	auto& food = result->food;
 	auto& bots = result->bots;
 
-	food.reserve(_foodMap.size());
-	for (auto& kvp: _foodMap) {
-		food.emplace_back(kvp.second);
+	food.assign(_foodMap.begin(), _foodMap.end());
+	bots.assign(_botsMap.begin(), _botsMap.end());
+
+	return result;
+}
+
+void TcpProtocol::WriteWorldUpdate(JsonWriter &writer) const
+{
+	writer.beginObject();
+	writer.key(JSON_KEY("bots"));
+	writer.idObject(_botsMap,
+		[](const BotItem& bot) { return bot.guid; },
+		[&writer](const BotItem& bot) { to_json(writer, bot); }
+	);
+	writer.key(JSON_KEY("food"));
+	writer.idObject(_foodMap,
+		[](const FoodItem& item) { return item.guid; },
+		[&writer](const FoodItem& item) { to_json(writer, item); }
+	);
+	writer.key(JSON_KEY("t")); writer.rawValue("\"WorldUpdate\"");
+	writer.endObject();
+}
+
+void TcpProtocol::PackWorldUpdate(msgpack::sbuffer &buf) const
+{
+	msgpack::packer<msgpack::sbuffer> packer(buf);
+	packer.pack_array(4);
+	packer.pack(MsgPackProtocol::PROTOCOL_VERSION);
+	packer.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_WORLD_UPDATE));
+
+	packer.pack_array(static_cast<uint32_t>(_botsMap.size()));
+	for (auto& bot: _botsMap)
+	{
+		packer.pack(bot);
 	}
 
-	bots.reserve(_botsMap.size());
-	for (auto& kvp: _botsMap) {
-		bots.emplace_back(kvp.second);
+	packer.pack_array(static_cast<uint32_t>(_foodMap.size()));
+	for (auto& item: _foodMap)
+	{
+		packer.pack(item);
 	}
+}
 
-	return result;
+void TcpProtocol::UpdateGrids()
+{
+	if (_gridsValid) { return; }
+
+	auto worldSizeX = static_cast<real_t>(_gameInfo.world_size_x);
+	auto worldSizeY = static_cast<real_t>(_gameInfo.world_size_y);
+
+	_botGrid.SetWorldSize(worldSizeX, worldSizeY);
+	uint32_t index = 0;
+	for (auto& bot: _botsMap)
+	{
+		if (!bot.segments.empty())
+		{
+			_botGrid.Add(bot.segments.front().position, index);
+		}
+		index++;
+	}
+	_botGrid.Build();
+
+	_foodGrid.SetWorldSize(worldSizeX, worldSizeY);
+	index = 0;
+	for (auto& item: _foodMap)
+	{
+		_foodGrid.Add(item.position, index++);
+	}
+	_foodGrid.Build();
+
+	_gridsValid = true;
 }
 
 void TcpProtocol::ClearLogItems()
 {
-	for (auto &kvp: _pendingLogItems)
+	_pendingLogItems.clear();
+}
+
+void TcpProtocol::Reset()
+{
+	_bufHead = 0;
+	_bufTail = 0;
+	std::vector<char>().swap(_buf);
+	_bufferStatistics.bufferSize = 0;
+	_pendingMessages.clear();
+	_pendingRawMessages.clear();
+	_arena.Reset();
+	_pendingLogItems.clear();
+	_logQuotas.clear();
+	_logWindowFrames = 0;
+	_removedFood.clear();
+	_botsMap.clear();
+	_foodMap.clear();
+	_gridsValid = false;
+}
+
+void TcpProtocol::FinishLogWindow()
+{
+	for (auto& quota: _logQuotas)
 	{
-		_pendingLogItems[kvp.first].clear();
+		if (quota.dropped > 0)
+		{
+			_pendingLogItems[quota.viewer_key].push_back({
+				quota.viewer_key,
+				"[relay] " + std::to_string(quota.dropped) + " log messages dropped"
+			});
+		}
 	}
+	_logQuotas.clear();
+	_logWindowFrames = 0;
+}
+
+void TcpProtocol::TruncateLogMessage(std::string &message)
+{
+	if (message.size() <= MAX_LOG_MESSAGE_LENGTH) { return; }
+	// don't split a UTF-8 sequence
+	size_t length = MAX_LOG_MESSAGE_LENGTH;
+	while ((length > 0) && ((static_cast<unsigned char>(message[length]) & 0xC0) == 0x80))
+	{
+		length--;
+	}
+	message.resize(length);
+	message.append("...");
+}
+
+void TcpProtocol::ReceiveMessage(const char *data, size_t size)
+{
+	if (_rawMessageCallback != nullptr)
+	{
+		_rawMessageCallback(data, size);
+	}
+	if (_metrics == nullptr)
+	{
+		OnMessageReceived(data+4, size-4);
+		return;
+	}
+
+	uint64_t start = Metrics::NowNs();
+	_currentMessageType = Metrics::MESSAGE_TYPE_COUNT - 1;
+	_frameCallbackNs = 0;
+	OnMessageReceived(data+4, size-4);
+	// a Tick's time includes the frame callback, which is recorded on its own
+	_metrics->RecordUpstreamMessage(_currentMessageType, size, Metrics::NowNs() - start - _frameCallbackNs);
 }
 
 void TcpProtocol::OnMessageReceived(const char* data, size_t count)
 {
-	msgpack::object_handle obj;
 	uint64_t version, message_type;
 
-	msgpack::unpack(obj, data, count);
-	if (obj.get().type != msgpack::type::ARRAY) { return; }
+	_currentMessageData = data;
+	_currentMessageSize = count;
 
-	auto arr = obj.get().via.array;
+	if (MsgPackVisitors::PeekMessageType(data, count, message_type))
+	{
+		_currentMessageType = message_type;
+		if (OnHotMessageReceived(message_type, data, count)) { return; }
+	}
+
+	// objects of the last message are released, the zone's first chunk is kept for the next one
+	_zone.clear();
+	msgpack::object obj = msgpack::unpack(_zone, data, count);
+	if (obj.type != msgpack::type::ARRAY) { return; }
+
+	auto arr = obj.via.array;
 	if (arr.size<2) { return; }
 	arr.ptr[0] >> version;
 	arr.ptr[1] >> message_type;
+	_currentMessageType = message_type;
 
 	switch (message_type)
 	{
 		case MsgPackProtocol::MESSAGE_TYPE_GAME_INFO:
-			OnGameInfoReceived(obj.get().as<MsgPackProtocol::GameInfoMessage>());
+			OnGameInfoReceived(obj.as<MsgPackProtocol::GameInfoMessage>());
 			break;
 
 		case MsgPackProtocol::MESSAGE_TYPE_WORLD_UPDATE:
-			OnWorldUpdateReceived(obj.get().as<MsgPackProtocol::WorldUpdateMessage>());
+			OnWorldUpdateReceived(obj.as<MsgPackProtocol::WorldUpdateMessage>());
 			break;
 
-		case MsgPackProtocol::MESSAGE_TYPE_TICK:
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_SPAWN:
 		{
-			OnTickReceived(obj.get().as<MsgPackProtocol::TickMessage>());
+			auto& msg = _arena.Make<MsgPackProtocol::BotSpawnMessage>();
+			obj.convert(msg);
+			OnBotSpawnReceived(msg);
 			break;
 		}
 
-		case MsgPackProtocol::MESSAGE_TYPE_BOT_SPAWN:
-			OnBotSpawnReceived(obj.get().as<MsgPackProtocol::BotSpawnMessage>());
-			break;
-
 		case MsgPackProtocol::MESSAGE_TYPE_BOT_KILL:
-			OnBotKillReceived(obj.get().as<MsgPackProtocol::BotKillMessage>());
-			break;
-
-		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE:
 		{
-			auto msg = std::make_unique<MsgPackProtocol::BotMoveMessage>();
-			obj.get().convert(*msg);
-			OnBotMoveReceived(std::move(msg));
+			auto& msg = _arena.Make<MsgPackProtocol::BotKillMessage>();
+			obj.convert(msg);
+			OnBotKillReceived(msg);
 			break;
 		}
 
 		case MsgPackProtocol::MESSAGE_TYPE_BOT_STATS:
 		{
-			auto msg = std::make_unique<MsgPackProtocol::BotStatsMessage>();
-			obj.get().convert(*msg);
-			OnBotStatsReceived(std::move(msg));
+			auto& msg = _arena.Make<MsgPackProtocol::BotStatsMessage>();
+			obj.convert(msg);
+			OnBotStatsReceived(msg);
 			break;
 		}
 
-		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD:
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_LOG:
 		{
-			auto msg = std::make_unique<MsgPackProtocol::BotMoveHeadMessage>();
-			obj.get().convert(*msg);
-			OnBotMoveHeadReceived(std::move(msg));
+			auto& msg = _arena.Make<MsgPackProtocol::BotLogMessage>();
+			obj.convert(msg);
+			OnBotLogReceived(msg);
 			break;
 		}
+	}
+}
 
-		case MsgPackProtocol::MESSAGE_TYPE_BOT_LOG:
+bool TcpProtocol::OnHotMessageReceived(uint64_t message_type, const char *data, size_t count)
+{
+	switch (message_type)
+	{
+		case MsgPackProtocol::MESSAGE_TYPE_TICK:
 		{
-			auto msg = std::make_unique<MsgPackProtocol::BotLogMessage>();
-			obj.get().convert(*msg);
-			OnBotLogReceived(std::move(msg));
-			break;
+			auto& msg = _arena.Make<MsgPackProtocol::TickMessage>();
+			if (MsgPackVisitors::ReadTick(data, count, msg.frame_id))
+			{
+				OnTickReceived(msg);
+			}
+			return true;
+		}
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE:
+		{
+			MsgPackVisitors::BotMoveVisitor visitor(_botMoveUpdates, _segmentBuffer);
+			if (MsgPackVisitors::Parse(data, count, visitor))
+			{
+				OnBotMoveReceived();
+			}
+			return true;
+		}
+
+		case MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD:
+		{
+			auto& msg = _arena.Make<MsgPackProtocol::BotMoveHeadMessage>();
+			MsgPackVisitors::BotMoveHeadVisitor visitor(msg);
+			if (MsgPackVisitors::Parse(data, count, visitor))
+			{
+				OnBotMoveHeadReceived(msg);
+			}
+			return true;
 		}
 
 		case MsgPackProtocol::MESSAGE_TYPE_FOOD_SPAWN:
-			OnFoodSpawnReceived(obj.get().as<MsgPackProtocol::FoodSpawnMessage>());
-			break;
+		{
+			auto& msg = _arena.Make<MsgPackProtocol::FoodSpawnMessage>();
+			MsgPackVisitors::FoodSpawnVisitor visitor(msg);
+			if (MsgPackVisitors::Parse(data, count, visitor))
+			{
+				OnFoodSpawnReceived(msg);
+			}
+			return true;
+		}
 
 		case MsgPackProtocol::MESSAGE_TYPE_FOOD_CONSUME:
-			OnFoodConsumedReceived(obj.get().as<MsgPackProtocol::FoodConsumeMessage>());
-			break;
+		{
+			auto& msg = _arena.Make<MsgPackProtocol::FoodConsumeMessage>();
+			MsgPackVisitors::FoodConsumeVisitor visitor(msg);
+			if (MsgPackVisitors::Parse(data, count, visitor))
+			{
+				OnFoodConsumedReceived(msg);
+			}
+			return true;
+		}
 
 		case MsgPackProtocol::MESSAGE_TYPE_FOOD_DECAY:
-			OnFoodDecayedReceived(obj.get().as<MsgPackProtocol::FoodDecayMessage>());
-			break;
+		{
+			auto& msg = _arena.Make<MsgPackProtocol::FoodDecayMessage>();
+			MsgPackVisitors::FoodDecayVisitor visitor(msg);
+			if (MsgPackVisitors::Parse(data, count, visitor))
+			{
+				OnFoodDecayedReceived(msg);
+			}
+			return true;
+		}
 	}
+	return false;
+}
+
+void TcpProtocol::AddPendingMessage(const MsgPackProtocol::Message& msg)
+{
+	_pendingMessages.push_back(&msg);
+	_pendingRawMessages.items.emplace_back(_pendingRawMessages.data.size(), _currentMessageSize);
+	_pendingRawMessages.types.push_back(static_cast<uint8_t>(msg.messageType));
+	_pendingRawMessages.data.append(_currentMessageData, _currentMessageSize);
 }
 
 void TcpProtocol::OnGameInfoReceived(const MsgPackProtocol::GameInfoMessage& msg)
@@ -166,106 +449,145 @@ void TcpProtocol::OnGameInfoReceived(const MsgPackProtocol::GameInfoMessage& msg
 
 void TcpProtocol::OnWorldUpdateReceived(const MsgPackProtocol::WorldUpdateMessage &msg)
 {
+	_worldUpdateCount++;
 	_botsMap.clear();
+	_botsMap.reserve(msg.bots.size());
 	for (auto& bot: msg.bots)
 	{
-		_botsMap.insert(std::make_pair(bot.guid, bot));
+		_botsMap.insert(bot.guid, bot);
 	}
 
 	_foodMap.clear();
+	_foodMap.reserve(msg.food.size());
 	for (auto& food: msg.food)
 	{
-		_foodMap.insert(std::make_pair(food.guid, food));
+		_foodMap.insert(food.guid, food);
 	}
 }
 
 void TcpProtocol::OnTickReceived(const MsgPackProtocol::TickMessage& msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::TickMessage>(msg));
+	AddPendingMessage(msg);
+	_gridsValid = false;
+	if (++_logWindowFrames >= LOG_WINDOW_FRAMES)
+	{
+		FinishLogWindow();
+	}
 	if (_frameCompleteCallback!=nullptr)
 	{
+		uint64_t start = _metrics ? Metrics::NowNs() : 0;
 		_frameCompleteCallback(msg.frame_id);
+		if (_metrics)
+		{
+			_frameCallbackNs = Metrics::NowNs() - start;
+			_metrics->frameCallbackNs.Observe(_frameCallbackNs);
+		}
 	}
 	_pendingMessages.clear();
+	_pendingRawMessages.clear();
+	_removedFood.clear();
+	// msg included, the frame's messages are reused from here on
+	_arena.Reset();
 }
 
+// the visitors only decode, the food state is updated here once the message parsed completely
 void TcpProtocol::OnFoodSpawnReceived(const MsgPackProtocol::FoodSpawnMessage& msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::FoodSpawnMessage>(msg));
+	AddPendingMessage(msg);
 	for (auto& item: msg.new_food)
 	{
-		_foodMap.insert(std::make_pair(item.guid, item));
+		_foodMap.insert(item.guid, item);
 	}
 }
 
-void TcpProtocol::OnFoodConsumedReceived(const MsgPackProtocol::FoodConsumeMessage &msg)
+void TcpProtocol::OnFoodConsumedReceived(const MsgPackProtocol::FoodConsumeMessage& msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::FoodConsumeMessage>(msg));
+	AddPendingMessage(msg);
 	for (auto& item: msg.items)
 	{
-		_foodMap.erase(item.food_id);
+		RemoveFood(item.food_id);
 	}
 }
 
-void TcpProtocol::OnFoodDecayedReceived(const MsgPackProtocol::FoodDecayMessage &msg)
+void TcpProtocol::OnFoodDecayedReceived(const MsgPackProtocol::FoodDecayMessage& msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::FoodDecayMessage>(msg));
+	AddPendingMessage(msg);
 	for (auto& id: msg.food_ids)
 	{
+		RemoveFood(id);
+	}
+}
+
+// remembers the position for viewports, which send removals only for food within their area
+void TcpProtocol::RemoveFood(guid_t id)
+{
+	auto* item = _foodMap.find(id);
+	if (item != nullptr)
+	{
+		_removedFood.insert(id, item->position);
 		_foodMap.erase(id);
 	}
 }
 
 void TcpProtocol::OnBotSpawnReceived(const MsgPackProtocol::BotSpawnMessage &msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::BotSpawnMessage>(msg));
-	auto result = _botsMap.insert(std::make_pair(msg.bot.guid, msg.bot));
-	(result.first)->second.segments.reserve(100);
+	AddPendingMessage(msg);
+	auto result = _botsMap.insert(msg.bot.guid, msg.bot);
+	(result.first)->segments.reserve(100);
 }
 
 void TcpProtocol::OnBotKillReceived(const MsgPackProtocol::BotKillMessage& msg)
 {
-	_pendingMessages.push_back(std::make_unique<MsgPackProtocol::BotKillMessage>(msg));
+	AddPendingMessage(msg);
 	_botsMap.erase(msg.victim_id);
 }
 
-void TcpProtocol::OnBotMoveReceived(std::unique_ptr<MsgPackProtocol::BotMoveMessage> msg)
+void TcpProtocol::OnBotLogReceived(MsgPackProtocol::BotLogMessage& msg)
 {
-	for (auto& item: msg->items)
+	for (auto& item: msg.items)
 	{
-		auto it = _botsMap.find(item.bot_id);
-		if (it != _botsMap.end())
+		auto* quota = _logQuotas.insert(item.viewer_key, { item.viewer_key, 0, 0 }).first;
+		if (quota->lines >= MAX_LOG_LINES_PER_WINDOW)
 		{
-			auto& bot = it->second;
-			bot.segments.reserve(bot.segments.size() + item.new_segments.size());
-			bot.segments.insert(bot.segments.begin(), item.new_segments.begin(), item.new_segments.end());
-			bot.segments.resize(item.current_length);
-			bot.segment_radius = item.current_segment_radius;
+			quota->dropped++;
+			continue;
 		}
+		quota->lines++;
 
+		auto& items = _pendingLogItems[item.viewer_key];
+		items.push_back(std::move(item));
+		TruncateLogMessage(items.back().message);
 	}
-	//_pendingMessages.push_back(std::move(msg));
 }
 
-void TcpProtocol::OnBotLogReceived(std::unique_ptr<MsgPackProtocol::BotLogMessage> msg)
+void TcpProtocol::OnBotStatsReceived(const MsgPackProtocol::BotStatsMessage& msg)
 {
-	for (auto& item: msg->items)
+	// assigned into the existing items, the message itself goes back to the arena with the frame
+	_botStats = msg;
+	if (_statsReceivedCallback!=nullptr)
 	{
-		_pendingLogItems[item.viewer_key].emplace_back(item);
+		_statsReceivedCallback(_botStats);
 	}
+	AddPendingMessage(msg);
 }
 
-void TcpProtocol::OnBotStatsReceived(std::unique_ptr<MsgPackProtocol::BotStatsMessage> msg)
+void TcpProtocol::OnBotMoveHeadReceived(const MsgPackProtocol::BotMoveHeadMessage& msg)
 {
-	_botStats = *msg;
-	if (_statsReceivedCallback!=nullptr)
-	{
-		_statsReceivedCallback(_botStats);
-	}
-	_pendingMessages.push_back(std::move(msg));
+	AddPendingMessage(msg);
 }
 
-void TcpProtocol::OnBotMoveHeadReceived(std::unique_ptr<MsgPackProtocol::BotMoveHeadMessage> msg)
+// BotMove is not forwarded, only the bot state is updated from _botMoveUpdates and _segmentBuffer
+void TcpProtocol::OnBotMoveReceived()
 {
-	_pendingMessages.push_back(std::move(msg));
+	for (auto& update: _botMoveUpdates)
+	{
+		auto* bot = _botsMap.find(update.bot_id);
+		if (bot != nullptr)
+		{
+			auto first = _segmentBuffer.begin() + update.firstSegment;
+			bot->segments.prepend(first, first + update.segmentCount);
+			bot->segments.resize(update.length);
+			bot->segment_radius = update.radius;
+		}
+	}
 }
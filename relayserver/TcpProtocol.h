@@ -6,6 +6,14 @@
 #include <memory>
 #include <map>
 #include "MsgPackProtocol.h"
+#include "MessageBundle.h"
+#include "MessageArena.h"
+#include "MsgPackVisitors.h"
+#include "GuidMap.h"
+#include "SpatialGrid.h"
+#include "Metrics.h"
+
+class JsonWriter;
 
 using BotItem = MsgPackProtocol::BotItem;
 using FoodItem = MsgPackProtocol::FoodItem;
@@ -16,41 +24,152 @@ class TcpProtocol
 	public:
 		typedef std::function<void(uint64_t frame_id)> FrameCompleteCallback;
 		typedef std::function<void(const MsgPackProtocol::BotStatsMessage& msg)> StatsReceivedCallback;
+		// every complete message including its length prefix, before it is processed
+		typedef std::function<void(const char* data, size_t size)> RawMessageCallback;
 		static constexpr const size_t BUFFER_SIZE = 1024*1024;
+		static constexpr const size_t MIN_READ_SIZE = 64*1024;
+		static constexpr const size_t MAX_MESSAGE_SIZE = 256*1024*1024;
+		// of the zone the remaining msgpack::unpack() messages are decoded into, it is reused for all of them
+		static constexpr const size_t ZONE_CHUNK_SIZE = 64*1024;
+
+		struct BufferStatistics
+		{
+			size_t bufferSize = 0;
+			size_t bufferedBytesHighWater = 0;
+			size_t messageSizeHighWater = 0;
+			uint64_t bufferGrowCount = 0;
+			uint64_t compactCount = 0;
+		};
 
 		TcpProtocol();
 		void SetFrameCompleteCallback(FrameCompleteCallback callback);
 		void SetStatsReceivedCallback(StatsReceivedCallback callback);
+		void SetRawMessageCallback(RawMessageCallback callback);
+		// records upstream messages, decode times and frame callback durations, nullptr disables it
+		void SetMetrics(Metrics* metrics) { _metrics = metrics; }
+		// reads everything available on the (non-blocking) socket and processes all complete messages
 		bool Read(int socket);
+		// processes length-prefixed messages from memory, data has to end with a complete message
+		bool Process(const char* data, size_t size);
+		const BufferStatistics& GetBufferStatistics() const { return _bufferStatistics; }
+		// drops everything received so far including the receive buffer, for a new upstream connection
+		void Reset();
 
 		const MsgPackProtocol::GameInfoMessage& GetGameInfo() const { return _gameInfo; }
 
 		std::unique_ptr<MsgPackProtocol::WorldUpdateMessage> MakeWorldUpdateMessage() const;
+		// encode the current world state as WorldUpdateMessage, without copying it into a message first
+		void WriteWorldUpdate(JsonWriter& writer) const;
+		void PackWorldUpdate(msgpack::sbuffer& buf) const;
+
+		// the messages of the current frame, only valid within the frame complete callback
+		const std::vector<const MsgPackProtocol::Message*>& GetPendingMessages() const { return _pendingMessages; }
+		// the upstream msgpack encoding of each pending message, exactly as received
+		const MessageBundle& GetPendingRawMessages() const { return _pendingRawMessages; }
+		// spatial queries on the world state, only valid within the frame complete callback
+		template <class F>
+		void ForEachBotIn(const SpatialGrid::Rect& area, F callback)
+		{
+			UpdateGrids();
+			_botGrid.Query(area, [&](uint32_t index) {
+				const BotItem& bot = *(_botsMap.begin() + index);
+				if (_botGrid.Contains(area, bot.segments.front().position)) { callback(bot); }
+			});
+		}
+
+		template <class F>
+		void ForEachFoodIn(const SpatialGrid::Rect& area, F callback)
+		{
+			UpdateGrids();
+			_foodGrid.Query(area, [&](uint32_t index) {
+				const FoodItem& item = *(_foodMap.begin() + index);
+				if (_foodGrid.Contains(area, item.position)) { callback(item); }
+			});
+		}
+
+		// for containment tests in world coordinates
+		const SpatialGrid& GetGrid() { UpdateGrids(); return _botGrid; }
+		const BotItem* GetBot(guid_t id) const { return _botsMap.find(id); }
+		const GuidMap<BotItem>& GetBots() const { return _botsMap; }
+		const GuidMap<FoodItem>& GetFood() const { return _foodMap; }
+		// WorldUpdates processed so far, each replaced the world state
+		uint64_t GetWorldUpdateCount() const { return _worldUpdateCount; }
+		// position of food consumed or decayed in the current frame
+		const Vector2D* GetRemovedFoodPosition(guid_t id) const { return _removedFood.find(id); }
 
-		const std::vector<std::unique_ptr<MsgPackProtocol::Message>>& GetPendingMessages() const { return _pendingMessages; }
+		// log items of the current frame by viewer key, only keys with items
 		typedef std::map<uint64_t, std::vector<MsgPackProtocol::BotLogItem>> LogItemMap;
 		const LogItemMap& GetPendingLogItems() const { return _pendingLogItems; }
 		void ClearLogItems();
 
+		// each viewer gets at most MAX_LOG_LINES_PER_WINDOW log lines every LOG_WINDOW_FRAMES frames,
+		// the number of dropped lines is reported at the end of the window
+		static constexpr const uint32_t LOG_WINDOW_FRAMES = 60;
+		static constexpr const uint32_t MAX_LOG_LINES_PER_WINDOW = 100;
+		// longer log lines are cut off
+		static constexpr const size_t MAX_LOG_MESSAGE_LENGTH = 1024;
+
 	private:
 		std::vector<char> _buf;
 		size_t _bufHead=0;
 		size_t _bufTail=0;
+		BufferStatistics _bufferStatistics;
 
 		FrameCompleteCallback _frameCompleteCallback;
 		StatsReceivedCallback _statsReceivedCallback;
+		RawMessageCallback _rawMessageCallback;
+		Metrics* _metrics = nullptr;
+		// of the message being processed, for the metrics
+		uint64_t _currentMessageType = 0;
+		uint64_t _frameCallbackNs = 0;
 		MsgPackProtocol::GameInfoMessage _gameInfo;
 		MsgPackProtocol::BotStatsMessage _botStats;
-		std::map<guid_t,FoodItem> _foodMap;
-		std::map<guid_t,BotItem> _botsMap;
-		std::vector<std::unique_ptr<MsgPackProtocol::Message>> _pendingMessages;
+		GuidMap<FoodItem> _foodMap;
+		GuidMap<BotItem> _botsMap;
+		GuidMap<Vector2D> _removedFood;
+		uint64_t _worldUpdateCount = 0;
+		SpatialGrid _botGrid; // bot heads
+		SpatialGrid _foodGrid;
+		bool _gridsValid = false;
+		// owns the pending messages
+		MessageArena _arena;
+		msgpack::zone _zone;
+		std::vector<const MsgPackProtocol::Message*> _pendingMessages;
+		MessageBundle _pendingRawMessages;
+		const char* _currentMessageData = nullptr;
+		size_t _currentMessageSize = 0;
+
+		struct LogQuota
+		{
+			uint64_t viewer_key;
+			uint32_t lines;
+			uint32_t dropped;
+		};
 
 		LogItemMap _pendingLogItems;
+		GuidMap<LogQuota> _logQuotas;
+		uint32_t _logWindowFrames = 0;
+		// of the BotMove message being processed
+		std::vector<MsgPackVisitors::BotMoveUpdate> _botMoveUpdates;
+		std::vector<SnakeSegmentItem> _segmentBuffer;
 
+		bool ProcessBuffer();
+		void MakeRoom(size_t required);
+		void UpdateGrids();
+		void FinishLogWindow();
+		static void TruncateLogMessage(std::string& message);
+
+		// data includes the length prefix
+		void ReceiveMessage(const char* data, size_t size);
 		void OnMessageReceived(const char *data, size_t count);
+		bool OnHotMessageReceived(uint64_t message_type, const char *data, size_t count);
+		// msg belongs to _arena
+		void AddPendingMessage(const MsgPackProtocol::Message& msg);
 
 		void OnGameInfoReceived(const MsgPackProtocol::GameInfoMessage& msg);
 		void OnWorldUpdateReceived(const MsgPackProtocol::WorldUpdateMessage& msg);
+
+		// the handlers below get messages of _arena
 		void OnTickReceived(const MsgPackProtocol::TickMessage &msg);
 
 		void OnFoodSpawnReceived(const MsgPackProtocol::FoodSpawnMessage& msg);
@@ -59,8 +178,9 @@ class TcpProtocol
 
 		void OnBotSpawnReceived(const MsgPackProtocol::BotSpawnMessage& msg);
 		void OnBotKillReceived(const MsgPackProtocol::BotKillMessage &msg);
-		void OnBotMoveReceived(std::unique_ptr<MsgPackProtocol::BotMoveMessage> msg);
-		void OnBotLogReceived(std::unique_ptr<MsgPackProtocol::BotLogMessage> msg);
-		void OnBotStatsReceived(std::unique_ptr<MsgPackProtocol::BotStatsMessage> msg);
-		void OnBotMoveHeadReceived(std::unique_ptr<MsgPackProtocol::BotMoveHeadMessage> msg);
+		void OnBotLogReceived(MsgPackProtocol::BotLogMessage& msg);
+		void OnBotStatsReceived(const MsgPackProtocol::BotStatsMessage& msg);
+		void OnBotMoveHeadReceived(const MsgPackProtocol::BotMoveHeadMessage& msg);
+		void OnBotMoveReceived();
+		void RemoveFood(guid_t id);
 };
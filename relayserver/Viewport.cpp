@@ -0,0 +1,184 @@
+#include "Viewport.h"
+#include "TcpProtocol.h"
+#include <algorithm>
+
+using namespace MsgPackProtocol;
+
+void Viewport::Set(real_t x, real_t y, real_t width, real_t height, real_t zoom)
+{
+	real_t w = width / zoom;
+	real_t h = height / zoom;
+	_view = { x - w/2, y - h/2, w, h };
+	if (!_enabled)
+	{
+		_enabled = true;
+		_snapshotRequired = true;
+	}
+}
+
+void Viewport::Disable()
+{
+	_enabled = false;
+	_knownBots.clear();
+}
+
+const std::vector<const Message*>& Viewport::Filter(TcpProtocol &proto)
+{
+	_messages.clear();
+	_ownedMessages.clear();
+
+	auto& pendingMessages = proto.GetPendingMessages();
+	// a WorldUpdate replaces the world without becoming a pending message
+	bool worldReset = (proto.GetWorldUpdateCount() != _worldUpdateCount);
+
+	if (_snapshotRequired || worldReset || !proto.GetGrid().Contains(_area, _view))
+	{
+		makeSnapshot(proto);
+		// the snapshot already contains all changes of this frame but its Tick
+		if (!pendingMessages.empty() && (pendingMessages.back()->messageType == MESSAGE_TYPE_TICK))
+		{
+			_messages.push_back(pendingMessages.back());
+		}
+		return _messages;
+	}
+
+	_visibleBots.clear();
+	proto.ForEachBotIn(_area, [this](const BotItem& bot) { _visibleBots.insert(bot.guid, bot.guid); });
+
+	for (auto& msg: pendingMessages)
+	{
+		if (msg->messageType == MESSAGE_TYPE_TICK)
+		{
+			addLeavingBots();
+			addEnteringBots(proto);
+		}
+		filterMessage(proto, *msg);
+	}
+
+	std::swap(_knownBots, _visibleBots);
+	return _messages;
+}
+
+void Viewport::makeSnapshot(TcpProtocol &proto)
+{
+	_area = {
+		_view.x - _view.width * MARGIN,
+		_view.y - _view.height * MARGIN,
+		_view.width * (1 + 2*MARGIN),
+		_view.height * (1 + 2*MARGIN)
+	};
+
+	_messages.push_back(&proto.GetGameInfo());
+	auto& msg = addMessage<WorldUpdateMessage>();
+
+	_knownBots.clear();
+	proto.ForEachBotIn(_area, [this, &msg](const BotItem& bot) {
+		msg.bots.push_back(bot);
+		_knownBots.insert(bot.guid, bot.guid);
+	});
+	proto.ForEachFoodIn(_area, [&msg](const FoodItem& item) {
+		msg.food.push_back(item);
+	});
+
+	_snapshotRequired = false;
+	_worldUpdateCount = proto.GetWorldUpdateCount();
+}
+
+void Viewport::filterMessage(TcpProtocol &proto, const Message &msg)
+{
+	auto& grid = proto.GetGrid();
+	switch (msg.messageType)
+	{
+		case MESSAGE_TYPE_BOT_SPAWN:
+			// sent by addEnteringBots() if the bot is within the area
+			break;
+
+		case MESSAGE_TYPE_BOT_KILL:
+			// erased so addLeavingBots() does not remove the victim a second time
+			if (_knownBots.erase(static_cast<const BotKillMessage&>(msg).victim_id))
+			{
+				_messages.push_back(&msg);
+			}
+			break;
+
+		case MESSAGE_TYPE_BOT_MOVE_HEAD:
+		{
+			BotMoveHeadMessage* filtered = nullptr;
+			for (auto& item: static_cast<const BotMoveHeadMessage&>(msg).items)
+			{
+				// bots just entering the area are sent with their full state instead
+				if ((_knownBots.find(item.bot_id) == nullptr) || (_visibleBots.find(item.bot_id) == nullptr)) { continue; }
+				if (filtered == nullptr) { filtered = &addMessage<BotMoveHeadMessage>(); }
+				filtered->items.push_back(item);
+			}
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_SPAWN:
+		{
+			FoodSpawnMessage* filtered = nullptr;
+			for (auto& item: static_cast<const FoodSpawnMessage&>(msg).new_food)
+			{
+				if (!grid.Contains(_area, item.position)) { continue; }
+				if (filtered == nullptr) { filtered = &addMessage<FoodSpawnMessage>(); }
+				filtered->new_food.push_back(item);
+			}
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_CONSUME:
+		{
+			FoodConsumeMessage* filtered = nullptr;
+			for (auto& item: static_cast<const FoodConsumeMessage&>(msg).items)
+			{
+				auto* pos = proto.GetRemovedFoodPosition(item.food_id);
+				if ((pos == nullptr) || !grid.Contains(_area, *pos)) { continue; }
+				if (filtered == nullptr) { filtered = &addMessage<FoodConsumeMessage>(); }
+				filtered->items.push_back(item);
+			}
+			break;
+		}
+
+		case MESSAGE_TYPE_FOOD_DECAY:
+		{
+			FoodDecayMessage* filtered = nullptr;
+			for (auto& id: static_cast<const FoodDecayMessage&>(msg).food_ids)
+			{
+				auto* pos = proto.GetRemovedFoodPosition(id);
+				if ((pos == nullptr) || !grid.Contains(_area, *pos)) { continue; }
+				if (filtered == nullptr) { filtered = &addMessage<FoodDecayMessage>(); }
+				filtered->food_ids.push_back(id);
+			}
+			break;
+		}
+
+		default:
+			_messages.push_back(&msg);
+			break;
+	}
+}
+
+// the client would keep showing them frozen at their last position otherwise
+void Viewport::addLeavingBots()
+{
+	for (auto id: _knownBots)
+	{
+		if (_visibleBots.find(id) != nullptr) { continue; }
+		auto& msg = addMessage<BotKillMessage>();
+		msg.killer_id = 0;
+		msg.victim_id = id;
+	}
+}
+
+void Viewport::addEnteringBots(TcpProtocol &proto)
+{
+	for (auto id: _visibleBots)
+	{
+		if (_knownBots.find(id) != nullptr) { continue; }
+		auto* bot = proto.GetBot(id);
+		if (bot != nullptr)
+		{
+			addMessage<BotSpawnMessage>().bot = *bot;
+		}
+	}
+}
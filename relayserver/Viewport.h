@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "MsgPackProtocol.h"
+#include "SpatialGrid.h"
+#include "GuidMap.h"
+
+class TcpProtocol;
+
+// part of the world a client is looking at. Once set, the client only
+// receives what happens in its area of interest (the viewport plus a margin):
+// food within it, and bots whose head is within it. A bot entering the area is
+// sent as BotSpawn with its full state, a bot leaving it is removed from the
+// client by a BotKill without killer (killer_id 0). When the viewport moves
+// out of the area a new area is chosen and a WorldUpdate restricted to it
+// replaces the client's world.
+class Viewport
+{
+	public:
+		static constexpr const real_t MARGIN = 0.5; // relative to the viewport size, on each side
+
+		bool IsEnabled() const { return _enabled; }
+		// center in world coordinates, size in pixels, zoom in pixels per world unit
+		void Set(real_t x, real_t y, real_t width, real_t height, real_t zoom);
+		void Disable();
+		// sends a new snapshot of the area with the next frame
+		void Resync() { _snapshotRequired = _enabled; }
+
+		// selects the messages of the current frame relevant to this viewport,
+		// the returned pointers are valid until the next call
+		const std::vector<const MsgPackProtocol::Message*>& Filter(TcpProtocol& proto);
+
+	private:
+		bool _enabled = false;
+		bool _snapshotRequired = false;
+		// of the world the last snapshot was taken from
+		uint64_t _worldUpdateCount = 0;
+		SpatialGrid::Rect _view = { 0, 0, 0, 0 };
+		SpatialGrid::Rect _area = { 0, 0, 0, 0 };
+
+		// ids of the bots the client has the state of, and of those in the area now
+		GuidMap<guid_t> _knownBots;
+		GuidMap<guid_t> _visibleBots;
+
+		std::vector<const MsgPackProtocol::Message*> _messages;
+		std::vector<std::unique_ptr<MsgPackProtocol::Message>> _ownedMessages;
+
+		void makeSnapshot(TcpProtocol& proto);
+		void filterMessage(TcpProtocol& proto, const MsgPackProtocol::Message& msg);
+		void addLeavingBots();
+		void addEnteringBots(TcpProtocol& proto);
+
+		template <class T>
+		T& addMessage()
+		{
+			_ownedMessages.push_back(std::make_unique<T>());
+			_messages.push_back(_ownedMessages.back().get());
+			return static_cast<T&>(*_ownedMessages.back());
+		}
+};
@@ -1,36 +1,212 @@
 #include "WebsocketConnection.h"
-#include "TcpProtocol.h"
-#include "MsgPackProtocol.h"
 #include "JsonProtocol.h"
+#include "CompactProtocol.h"
+#include "PreparedFrame.h"
+#include "SnapshotCache.h"
+#include "Deflater.h"
+#include "Metrics.h"
 
-WebsocketConnection::WebsocketConnection(uWS::WebSocket<uWS::SERVER> *websocket)
-	: _websocket(websocket)
+WebsocketConnection::WebsocketConnection(uWS::WebSocket<uWS::SERVER> *websocket, const BackpressureLimits &limits, LogRouter &logRouter)
+	: _websocket(websocket), _logRouter(logRouter), _limits(limits)
 {
 }
 
-void WebsocketConnection::FrameComplete(uint64_t frame_id, const TcpProtocol &proto)
+WebsocketConnection::~WebsocketConnection()
 {
-	(void) frame_id;
-	if (!_firstFrameSent)
+	_logRouter.Remove(_viewerKey, this);
+}
+
+void WebsocketConnection::setViewerKey(uint64_t key)
+{
+	_logRouter.Remove(_viewerKey, this);
+	_viewerKey = key;
+	_logRouter.Add(_viewerKey, this);
+}
+
+bool WebsocketConnection::beginFrame()
+{
+	if (_lagging)
 	{
-		sendInitialData(proto);
-		_firstFrameSent = true;
+		// skip frames until everything queued is written, then start over with a snapshot
+		if (getBufferedBytes() > 0)
+		{
+			Metrics::Get().framesSkipped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		_lagging = false;
+		resync();
+		return true;
 	}
+
+	if ((getBufferedBytes() > _limits.maxBufferedBytes) || (getFramesBehind() > _limits.maxFramesBehind))
+	{
+		if (_limits.disconnect)
+		{
+			Metrics::Get().clientsDisconnected.fetch_add(1, std::memory_order_relaxed);
+			_websocket->close(1013, "client too slow");
+			return false;
+		}
+		Metrics::Get().framesSkipped.fetch_add(1, std::memory_order_relaxed);
+		_lagging = true;
+		return false;
+	}
+	return true;
 }
 
-void WebsocketConnection::LogMessage(uint64_t frame_id, const std::string &message)
+void WebsocketConnection::endFrame()
 {
-	json j = { { "t", "Log" }, { "frame", frame_id }, { "msg", message} };
-	sendString(j.dump());
+	if (_bytesSent < _bytesQueued)
+	{
+		_frameEnds.push_back(_bytesQueued);
+	}
 }
 
-void WebsocketConnection::sendInitialData(const TcpProtocol &proto)
+void WebsocketConnection::onMessageSent(uWS::WebSocket<uWS::SERVER> *websocket, void *data, bool cancelled, void *reserved)
 {
-	sendString(json(proto.GetGameInfo()).dump());
-	sendString(json(*proto.MakeWorldUpdateMessage()).dump());
+	// messages still queued when a socket closes are cancelled without a socket, their connection is gone already
+	if (!websocket) { return; }
+	auto *con = static_cast<WebsocketConnection*>(websocket->getUserData());
+	if (!con) { return; }
+
+	con->_bytesSent += reinterpret_cast<uintptr_t>(data);
+	while (!con->_frameEnds.empty() && (con->_frameEnds.front() <= con->_bytesSent))
+	{
+		con->_frameEnds.pop_front();
+	}
+}
+
+void WebsocketConnection::FrameComplete(uint64_t frame_id, SnapshotCache &snapshot)
+{
+	// viewport clients get a snapshot of their area with the next viewport frame
+	if (needsInitialData())
+	{
+		sendInitialData(snapshot.Get(getSnapshotFormat(), frame_id, _compression));
+	}
+}
+
+void WebsocketConnection::sendLogs(const MessageBundle &logs)
+{
+	// clients waiting for a snapshot get nothing else before it
+	if (_lagging || needsInitialData()) { return; }
+	if (!(_subscription & Subscription::GetBit(MsgPackProtocol::MESSAGE_TYPE_BOT_LOG))) { return; }
+	// always JSON, also for msgpack clients
+	sendBundle(logs, uWS::OpCode::TEXT);
+}
+
+void WebsocketConnection::setViewport(real_t x, real_t y, real_t width, real_t height, real_t zoom)
+{
+	_viewport.Set(x, y, width, height, zoom);
+}
+
+void WebsocketConnection::disableViewport()
+{
+	if (_viewport.IsEnabled())
+	{
+		_viewport.Disable();
+		// back to the full world
+		_firstFrameSent = false;
+	}
+}
+
+void WebsocketConnection::sendInitialData(PreparedFrame &snapshot)
+{
+	sendPrepared(snapshot);
+	_firstFrameSent = true;
+}
+
+void WebsocketConnection::resync()
+{
+	Metrics::Get().clientsResynced.fetch_add(1, std::memory_order_relaxed);
+	_firstFrameSent = false;
+	_coalescing = false;
+	_viewport.Resync();
+}
+
+void WebsocketConnection::setRateClass(int rateClass)
+{
+	// whatever was merged for the old class since its last update is lost
+	if (_coalescing)
+	{
+		resync();
+	}
+	_rateClass = rateClass;
+}
+
+void WebsocketConnection::setSubscription(Subscription::Mask mask)
+{
+	// the client missed the events of the types it did not subscribe to so far
+	if (mask & ~_subscription)
+	{
+		resync();
+	}
+	_subscription = mask;
 }
 
 void WebsocketConnection::sendString(std::string data)
 {
-	_websocket->send(data.data(), data.length(), uWS::OpCode::TEXT);
+	send(data.data(), data.length(), uWS::OpCode::TEXT);
+}
+
+void WebsocketConnection::sendPrepared(PreparedFrame &frame)
+{
+	for (auto* msg: frame.GetMessages())
+	{
+		_bytesQueued += msg->length;
+		_websocket->sendPrepared(msg, reinterpret_cast<void*>(static_cast<uintptr_t>(msg->length)));
+	}
+}
+
+void WebsocketConnection::sendViewportFrame(TcpProtocol &proto, const CompactIds *compactIds)
+{
+	auto* messages = &_viewport.Filter(proto);
+	if (_subscription != Subscription::ALL)
+	{
+		_subscribedMessages.clear();
+		for (auto* msg: *messages)
+		{
+			if (Subscription::GetBit(msg->messageType) & _subscription)
+			{
+				_subscribedMessages.push_back(msg);
+			}
+		}
+		messages = &_subscribedMessages;
+	}
+	if (_msgPack)
+	{
+		MsgPackProtocol::packBundle(_viewportBundle, *messages);
+	}
+	else
+	{
+		// bots entering the viewport were spawned before, in frames the client did not get
+		CompactProtocol::writeJsonBundle(_viewportBundle, *messages, compactIds, CompactProtocol::INFO_ALL);
+	}
+	sendBundle(_viewportBundle, _msgPack ? uWS::OpCode::BINARY : uWS::OpCode::TEXT);
+}
+
+void WebsocketConnection::sendBundle(const MessageBundle &bundle, uWS::OpCode opCode)
+{
+	if (_tickBundle)
+	{
+		send(bundle.data.data(), bundle.data.size(), opCode);
+		return;
+	}
+	for (auto& item: bundle.items)
+	{
+		send(bundle.data.data() + item.first, item.second, opCode);
+	}
+}
+
+// messages only this client gets, so they are compressed per socket
+void WebsocketConnection::send(const char *data, size_t length, uWS::OpCode opCode)
+{
+	if ((_compression == PreparedFrame::COMPRESSION_DICTIONARY) && Deflater::Get(true).Compress(data, length, _compressBuffer))
+	{
+		data = _compressBuffer.data();
+		length = _compressBuffer.size();
+		opCode = uWS::OpCode::BINARY;
+	}
+	bool compress = (_compression == PreparedFrame::COMPRESSION_DEFLATE) && (length >= PreparedFrame::MIN_DEFLATE_SIZE);
+
+	_bytesQueued += length;
+	_websocket->send(data, length, opCode, &WebsocketConnection::onMessageSent, reinterpret_cast<void*>(static_cast<uintptr_t>(length)), compress);
 }
@@ -1,24 +1,99 @@
 #pragma once
 
+#include <stdint.h>
+#include <deque>
+#include <vector>
 #include <uWS.h>
-
-class TcpProtocol;
+#include "Viewport.h"
+#include "TcpProtocol.h"
+#include "SnapshotCache.h"
+#include "PreparedFrame.h"
+#include "LogRouter.h"
+#include "Subscription.h"
 
 class WebsocketConnection
 {
 	public:
-		WebsocketConnection(uWS::WebSocket<uWS::SERVER> *websocket);
-		void FrameComplete(uint64_t frame_id, const TcpProtocol& proto);
-		void LogMessage(uint64_t frame_id, const std::string& message);
+		// limits for clients that do not keep up with the frame rate
+		struct BackpressureLimits
+		{
+			// bytes waiting in the socket's send queue
+			uint64_t maxBufferedBytes = 4*1024*1024;
+			// frames not completely written to the socket yet
+			size_t maxFramesBehind = 60;
+			// close the connection instead of skipping frames until it caught up
+			bool disconnect = false;
+		};
+
+		WebsocketConnection(uWS::WebSocket<uWS::SERVER> *websocket, const BackpressureLimits& limits, LogRouter& logRouter);
+		~WebsocketConnection();
+		WebsocketConnection(const WebsocketConnection&) = delete;
+		WebsocketConnection& operator=(const WebsocketConnection&) = delete;
+		// false if nothing of this frame should be sent, because the client is too far behind.
+		// Might close the connection, which deletes this object.
+		bool beginFrame();
+		void endFrame();
+		uint64_t getBufferedBytes() { return _bytesQueued - _bytesSent; }
+		size_t getFramesBehind() { return _frameEnds.size(); }
+		// send callback of all messages, data is the message size
+		static void onMessageSent(uWS::WebSocket<uWS::SERVER> *websocket, void *data, bool cancelled, void *reserved);
+		void FrameComplete(uint64_t frame_id, SnapshotCache& snapshot);
+		// log messages of one frame, skipped while the client is behind
+		void sendLogs(const MessageBundle& logs);
 		void sendString(std::string data);
+		void sendPrepared(PreparedFrame& frame);
+		bool needsInitialData() { return !_firstFrameSent && !_viewport.IsEnabled(); }
+		void sendInitialData(PreparedFrame& snapshot);
+		SnapshotCache::Format getSnapshotFormat() { return _msgPack ? SnapshotCache::FORMAT_MSGPACK : SnapshotCache::FORMAT_JSON; }
+		// the client missed frames, start over with a snapshot
+		void resync();
+		// sends the part of the current frame within the viewport, instead of the shared frame.
+		// compactIds is only given in compact JSON mode.
+		void sendViewportFrame(TcpProtocol& proto, const CompactIds* compactIds);
 		uint64_t getViewerKey() { return _viewerKey; }
-		void setViewerKey(uint64_t key) { _viewerKey = key; }
+		void setViewerKey(uint64_t key);
+		bool isTickBundleEnabled() { return _tickBundle; }
+		void setTickBundleEnabled(bool enabled) { _tickBundle = enabled; }
+		bool isMsgPackEnabled() const { return _msgPack; }
+		void setMsgPackEnabled(bool enabled) { _msgPack = enabled; }
+		PreparedFrame::Compression getCompression() { return _compression; }
+		void setCompression(PreparedFrame::Compression compression) { _compression = compression; }
+		// FrameCoalescer rate class, -1 for every frame
+		int getRateClass() const { return _rateClass; }
+		void setRateClass(int rateClass);
+		// rate limited connections get full frames up to the first due frame of their class, merged ones after it
+		bool isCoalescing() { return _coalescing; }
+		void startCoalescing() { _coalescing = true; }
+		// message types of the shared frames this client gets
+		Subscription::Mask getSubscription() const { return _subscription; }
+		void setSubscription(Subscription::Mask mask);
+		bool isViewportEnabled() { return _viewport.IsEnabled(); }
+		void setViewport(real_t x, real_t y, real_t width, real_t height, real_t zoom);
+		void disableViewport();
 
 	private:
 		uWS::WebSocket<uWS::SERVER> *_websocket;
+		LogRouter& _logRouter;
 		bool _firstFrameSent = false;
 		uint64_t _viewerKey = 0;
+		bool _tickBundle = false;
+		bool _msgPack = false;
+		PreparedFrame::Compression _compression = PreparedFrame::COMPRESSION_NONE;
+		int _rateClass = -1;
+		bool _coalescing = false;
+		Subscription::Mask _subscription = Subscription::ALL;
+		std::vector<const MsgPackProtocol::Message*> _subscribedMessages;
+		std::string _compressBuffer;
+		Viewport _viewport;
+		MessageBundle _viewportBundle;
+		BackpressureLimits _limits;
+		bool _lagging = false;
+		uint64_t _bytesQueued = 0;
+		uint64_t _bytesSent = 0;
+		// value of _bytesQueued at the end of each frame that is not sent completely
+		std::deque<uint64_t> _frameEnds;
 
-		void sendInitialData(const TcpProtocol& proto);
+		void sendBundle(const MessageBundle& bundle, uWS::OpCode opCode);
+		void send(const char* data, size_t length, uWS::OpCode opCode);
 
 };
@@ -0,0 +1,116 @@
+// Serves a recording made with RECORD_FILE like a gameserver would, so a
+// relay can connect to it on GAMESERVER_PORT. Each connection gets the
+// recording from REPLAY_START_FRAME on, at REPLAY_SPEED (1 is real time,
+// 0 as fast as possible), and is closed at its end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <thread>
+#include "StreamReplay.h"
+
+namespace
+{
+	const char* getEnvOrDefault(const char* envVar, const char* defaultValue)
+	{
+		const char* value = getenv(envVar);
+		return (value == nullptr) ? defaultValue : value;
+	}
+
+	int listenTcpSocket(int port)
+	{
+		int fd = socket(AF_INET6, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			perror("socket");
+			return -1;
+		}
+		int enable = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+		struct sockaddr_in6 addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr = in6addr_any;
+		addr.sin6_port = htons(static_cast<uint16_t>(port));
+		if ((bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(fd, 1) != 0))
+		{
+			perror("listen");
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	bool sendAll(int fd, const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+			if (sent < 0)
+			{
+				if (errno == EINTR) { continue; }
+				return false;
+			}
+			data += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+}
+
+int main()
+{
+	const char* replayFile = getEnvOrDefault("REPLAY_FILE", "");
+	int port = atoi(getEnvOrDefault("GAMESERVER_PORT", "9010"));
+	double speed = atof(getEnvOrDefault("REPLAY_SPEED", "1"));
+	uint64_t startFrame = strtoull(getEnvOrDefault("REPLAY_START_FRAME", "0"), nullptr, 10);
+
+	StreamReplay replay;
+	if (!replay.Open(replayFile))
+	{
+		return -1;
+	}
+	replay.SetSpeed(speed);
+
+	int listenSocket = listenTcpSocket(port);
+	if (listenSocket < 0)
+	{
+		return -1;
+	}
+	fprintf(stderr, "listening on port %d...\n", port);
+
+	while (true)
+	{
+		int fd = accept(listenSocket, nullptr, nullptr);
+		if (fd < 0)
+		{
+			if (errno == EINTR) { continue; }
+			perror("accept");
+			return -1;
+		}
+		fprintf(stderr, "relay connected, replaying from frame %llu\n", static_cast<unsigned long long>(startFrame));
+
+		bool connected = replay.Seek(startFrame);
+		int timeout;
+		while (connected && ((timeout = replay.GetTimeout()) >= 0))
+		{
+			if (timeout > 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+				continue;
+			}
+			const char* data;
+			size_t size;
+			connected = replay.NextFrame(data, size) && sendAll(fd, data, size);
+		}
+
+		fprintf(stderr, connected ? "end of recording.\n" : "relay disconnected.\n");
+		close(fd);
+	}
+}
@@ -0,0 +1,200 @@
+// Checks that the streaming encoders produce exactly the bytes of
+// nlohmann::json::dump(): every message type, string escaping and number
+// formatting. Exits with 1 and prints both encodings on a mismatch.
+
+#include <stdio.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "JsonProtocol.h"
+#include "JsonWriter.h"
+
+using namespace MsgPackProtocol;
+
+namespace
+{
+	int failures = 0;
+	int checks = 0;
+
+	void check(const std::string& name, const std::string& expected, const std::string& actual)
+	{
+		checks++;
+		if (expected == actual) { return; }
+		failures++;
+		fprintf(stderr, "FAIL %s\n  nlohmann:   %s\n  JsonWriter: %s\n", name.c_str(), expected.c_str(), actual.c_str());
+	}
+
+	void checkMessage(const std::string& name, const Message& msg)
+	{
+		json j;
+		to_json(j, msg);
+		std::string buf;
+		JsonWriter writer(buf);
+		to_json(writer, msg);
+		check(name, j.dump(), buf);
+	}
+
+	void checkString(const std::string& value)
+	{
+		std::string buf;
+		JsonWriter writer(buf);
+		writer.stringValue(value);
+		check("string " + json(value).dump(), json(value).dump(), buf);
+	}
+
+	void checkDouble(double value)
+	{
+		std::string buf;
+		JsonWriter writer(buf);
+		writer.doubleValue(value);
+		check("double " + json(value).dump(), json(value).dump(), buf);
+	}
+
+	// control characters, quotes, backslashes and UTF-8 beyond ASCII
+	const std::vector<std::string> STRINGS = {
+		"",
+		"plain name",
+		"quote \" backslash \\ slash /",
+		"\b\f\n\r\t",
+		std::string("nul \0 inside", 12),
+		"\x01\x02\x1e\x1f \x7f",
+		"Schl\xc3\xa4nge \xe2\x82\xac \xf0\x9f\x90\x8d",
+	};
+
+	const std::vector<double> DOUBLES = {
+		0.0, -0.0, 1.0, -1.0, 0.1, 1.0/3, 2.5, -123.456, 1e-7, 1e21, 1e300, -1e-300,
+		123456789.125, 4.9406564584124654e-324, 1.7976931348623157e308,
+		static_cast<double>(0.1f), static_cast<double>(static_cast<real_t>(1.0/3)),
+		std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(),
+	};
+
+	BotItem makeBot(guid_t guid, const std::string& name)
+	{
+		BotItem bot;
+		bot.guid = guid;
+		bot.name = name;
+		bot.database_id = -17;
+		bot.face_id = 3;
+		bot.dog_tag_id = 4000000000u;
+		bot.color = { 0xff0000, 0x00ff00 };
+		bot.mass = 12.75f;
+		bot.segment_radius = 0.1f;
+		bot.segments.push_back({ guid, { 1.5f, -2.25f } });
+		bot.segments.push_back({ guid, { 1.0f/3, 1e-7f } });
+		return bot;
+	}
+
+	FoodItem makeFood(guid_t guid, real_t x, real_t y, real_t value)
+	{
+		FoodItem item;
+		item.guid = guid;
+		item.position = Vector2D(x, y);
+		item.value = value;
+		return item;
+	}
+}
+
+int main()
+{
+	for (auto& value: STRINGS)
+	{
+		checkString(value);
+	}
+	for (auto value: DOUBLES)
+	{
+		checkDouble(value);
+	}
+
+	GameInfoMessage gameInfo;
+	gameInfo.world_size_x = 1024;
+	gameInfo.world_size_y = 768.5;
+	gameInfo.food_decay_per_frame = 0.001;
+	gameInfo.snake_distance_per_step = 1.0/3;
+	gameInfo.snake_segment_distance_factor = 0.2;
+	gameInfo.snake_segment_distance_exponent = 0.3;
+	gameInfo.snake_pull_factor = 1e-5;
+	checkMessage("GameInfo", gameInfo);
+
+	// ids of different lengths and a duplicate, objects keyed by id are sorted as strings
+	WorldUpdateMessage worldUpdate;
+	worldUpdate.bots.push_back(makeBot(100, STRINGS[2]));
+	worldUpdate.bots.push_back(makeBot(9, STRINGS[6]));
+	worldUpdate.bots.push_back(makeBot(10, STRINGS[3]));
+	worldUpdate.bots.push_back(makeBot(9, STRINGS[5]));
+	worldUpdate.food.push_back(makeFood(18446744073709551615ull, 0.5f, -0.25f, 3));
+	worldUpdate.food.push_back(makeFood(2, 1e20f, 1.0f/7, 0.1f));
+	worldUpdate.food.push_back(makeFood(11, -0.0f, 0, 1e-30f));
+	checkMessage("WorldUpdate", worldUpdate);
+	checkMessage("WorldUpdate (empty)", WorldUpdateMessage());
+
+	TickMessage tick;
+	tick.frame_id = 123456789012345ull;
+	checkMessage("Tick", tick);
+
+	for (auto& name: STRINGS)
+	{
+		BotSpawnMessage spawn;
+		spawn.bot = makeBot(42, name);
+		checkMessage("BotSpawn " + json(name).dump(), spawn);
+	}
+
+	BotKillMessage kill;
+	kill.killer_id = 1;
+	kill.victim_id = 18446744073709551615ull;
+	checkMessage("BotKill", kill);
+
+	BotMoveMessage move;
+	move.items.push_back({ 5, { { 5, { 1.25f, 2.0f } }, { 5, { -3.0f, 0.1f } } }, 17, 0.5f });
+	move.items.push_back({ 6, {}, 0, 1e-3f });
+	checkMessage("BotMove", move);
+
+	BotStatsMessage stats;
+	stats.items.push_back({ 20, 1.5, 0.1, 1.0/3, 1e21 });
+	stats.items.push_back({ 3, 0, -0.0, 2, 1e-7 });
+	stats.items.push_back({ 20, 4, 5, 6, 7 });
+	checkMessage("BotStats", stats);
+
+	BotMoveHeadMessage moveHead;
+	moveHead.items.push_back({ 7, 10.0/3, { { 0.5f, 0.25f }, { 1e7f, -1e-7f } } });
+	moveHead.items.push_back({ 8, 0, {} });
+	checkMessage("BotMoveHead", moveHead);
+
+	FoodSpawnMessage foodSpawn;
+	foodSpawn.new_food = worldUpdate.food;
+	checkMessage("FoodSpawn", foodSpawn);
+
+	FoodConsumeMessage foodConsume;
+	foodConsume.items.push_back({ 2, 100 });
+	foodConsume.items.push_back({ 18446744073709551615ull, 0 });
+	checkMessage("FoodConsume", foodConsume);
+
+	FoodDecayMessage foodDecay;
+	foodDecay.food_ids = { 0, 11, 18446744073709551615ull };
+	checkMessage("FoodDecay", foodDecay);
+
+	PlayerInfoMessage playerInfo;
+	playerInfo.player_id = 77;
+	checkMessage("PlayerInfo", playerInfo);
+
+	// BotLog is not compared: its items are delivered per viewer by LogRouter,
+	// the message itself is never encoded
+
+	std::vector<std::unique_ptr<Message>> messages;
+	messages.push_back(std::make_unique<TickMessage>(tick));
+	messages.push_back(std::make_unique<BotKillMessage>(kill));
+	messages.push_back(std::make_unique<FoodDecayMessage>(foodDecay));
+	MessageBundle bundle;
+	writeJsonBundle(bundle, messages);
+	json array = json::array();
+	for (auto& msg: messages)
+	{
+		json j;
+		to_json(j, *msg);
+		array.push_back(j);
+	}
+	check("writeJsonBundle", array.dump(), bundle.data);
+
+	printf("%d of %d checks passed\n", checks - failures, checks);
+	return (failures == 0) ? 0 : 1;
+}
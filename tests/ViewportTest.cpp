@@ -0,0 +1,204 @@
+// Feeds a short game through TcpProtocol and checks what a Viewport passes
+// on: a bot leaving the area is removed from the client, re-entering sends
+// it once as BotSpawn, and its later BotKill is forwarded. Exits with 1 on a
+// mismatch.
+
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include "TcpProtocol.h"
+#include "Viewport.h"
+
+using namespace MsgPackProtocol;
+
+namespace
+{
+	int failures = 0;
+	int checks = 0;
+
+	void check(const std::string& name, bool ok)
+	{
+		checks++;
+		if (ok) { return; }
+		failures++;
+		fprintf(stderr, "FAIL %s\n", name.c_str());
+	}
+
+	void append(std::string& out, const Message& msg)
+	{
+		msgpack::sbuffer buf;
+		pack(buf, msg);
+		uint32_t length = htonl(static_cast<uint32_t>(buf.size()));
+		out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.append(buf.data(), buf.size());
+	}
+
+	BotItem makeBot(guid_t guid, real_t x, real_t y)
+	{
+		BotItem bot;
+		bot.guid = guid;
+		bot.name = "bot";
+		bot.database_id = 1;
+		bot.face_id = 0;
+		bot.dog_tag_id = 0;
+		bot.color = { 0xff0000 };
+		bot.mass = 10;
+		bot.segment_radius = 1;
+		bot.segments.push_back({ guid, Vector2D(x, y) });
+		return bot;
+	}
+
+	// moves the head of the bot to x, y
+	void appendMove(std::string& out, guid_t guid, real_t x, real_t y)
+	{
+		BotMoveMessage move;
+		move.items.push_back({ guid, { { guid, Vector2D(x, y) } }, 1, 1 });
+		append(out, move);
+		BotMoveHeadMessage moveHead;
+		moveHead.items.push_back({ guid, 10, { Vector2D(x, y) } });
+		append(out, moveHead);
+	}
+
+	void appendKill(std::string& out, guid_t killer, guid_t victim)
+	{
+		BotKillMessage kill;
+		kill.killer_id = killer;
+		kill.victim_id = victim;
+		append(out, kill);
+	}
+
+	void appendTick(std::string& out, uint64_t frame_id)
+	{
+		TickMessage tick;
+		tick.frame_id = frame_id;
+		append(out, tick);
+	}
+
+	// the viewport's output of the frame
+	struct Frame
+	{
+		std::vector<guid_t> spawned;
+		std::vector<BotKillMessage> killed;
+		std::vector<guid_t> moved;
+		size_t worldUpdates = 0;
+	};
+
+	Frame summarize(const std::vector<const Message*>& messages)
+	{
+		Frame frame;
+		for (auto* msg: messages)
+		{
+			switch (msg->messageType)
+			{
+				case MESSAGE_TYPE_BOT_SPAWN:
+					frame.spawned.push_back(static_cast<const BotSpawnMessage*>(msg)->bot.guid);
+					break;
+				case MESSAGE_TYPE_BOT_KILL:
+					frame.killed.push_back(*static_cast<const BotKillMessage*>(msg));
+					break;
+				case MESSAGE_TYPE_BOT_MOVE_HEAD:
+					for (auto& item: static_cast<const BotMoveHeadMessage*>(msg)->items)
+					{
+						frame.moved.push_back(item.bot_id);
+					}
+					break;
+				case MESSAGE_TYPE_WORLD_UPDATE:
+					frame.worldUpdates++;
+					break;
+				default:
+					break;
+			}
+		}
+		return frame;
+	}
+
+	bool contains(const std::vector<guid_t>& ids, guid_t id)
+	{
+		for (auto i: ids)
+		{
+			if (i == id) { return true; }
+		}
+		return false;
+	}
+}
+
+int main()
+{
+	TcpProtocol proto;
+	Viewport viewport;
+	// the area is (0, 0) to (200, 200)
+	viewport.Set(100, 100, 100, 100, 1);
+
+	std::vector<Frame> frames;
+	proto.SetFrameCompleteCallback([&](uint64_t) {
+		frames.push_back(summarize(viewport.Filter(proto)));
+	});
+
+	std::string data;
+	GameInfoMessage gameInfo;
+	gameInfo.world_size_x = 1000;
+	gameInfo.world_size_y = 1000;
+	append(data, gameInfo);
+	WorldUpdateMessage worldUpdate;
+	worldUpdate.bots.push_back(makeBot(1, 100, 100));
+	worldUpdate.bots.push_back(makeBot(2, 120, 120));
+	append(data, worldUpdate);
+	// frame 0: snapshot
+	appendTick(data, 0);
+	// frame 1: bot 1 leaves the area, bot 2 is killed within it
+	appendMove(data, 1, 500, 500);
+	appendKill(data, 1, 2);
+	appendTick(data, 1);
+	// frame 2: bot 1 moves outside the area
+	appendMove(data, 1, 520, 500);
+	appendTick(data, 2);
+	// frame 3: bot 1 re-enters
+	appendMove(data, 1, 110, 100);
+	appendTick(data, 3);
+	// frame 4: bot 1 moves within the area
+	appendMove(data, 1, 112, 100);
+	appendTick(data, 4);
+	// frame 5: bot 1 is killed
+	appendKill(data, 7, 1);
+	appendTick(data, 5);
+
+	check("Process", proto.Process(data.data(), data.size()));
+	check("frame count", frames.size() == 6);
+	if (frames.size() != 6)
+	{
+		printf("%d of %d checks passed\n", checks - failures, checks);
+		return 1;
+	}
+
+	check("snapshot", (frames[0].worldUpdates == 1) && frames[0].spawned.empty() && frames[0].killed.empty());
+
+	auto& left = frames[1];
+	check("leaving bot is not moved", !contains(left.moved, 1));
+	check("leaving bot and victim removed once each", left.killed.size() == 2);
+	for (auto& kill: left.killed)
+	{
+		if (kill.victim_id == 1) { check("leaving bot removed without killer", kill.killer_id == 0); }
+		else { check("victim killed by bot 1", (kill.victim_id == 2) && (kill.killer_id == 1)); }
+	}
+	check("no spawn while leaving", left.spawned.empty());
+
+	auto& outside = frames[2];
+	check("outside: nothing sent", outside.spawned.empty() && outside.killed.empty() && outside.moved.empty());
+
+	auto& entered = frames[3];
+	check("re-entering bot spawned once", (entered.spawned.size() == 1) && (entered.spawned[0] == 1));
+	check("re-entering bot is not moved", !contains(entered.moved, 1));
+	check("no kill on re-entering", entered.killed.empty());
+
+	auto& inside = frames[4];
+	check("known bot moved", (inside.moved.size() == 1) && (inside.moved[0] == 1));
+	check("known bot not spawned again", inside.spawned.empty());
+
+	auto& killed = frames[5];
+	check("kill forwarded once", killed.killed.size() == 1);
+	check("kill keeps its killer", !killed.killed.empty() && (killed.killed[0].victim_id == 1) && (killed.killed[0].killer_id == 7));
+
+	printf("%d of %d checks passed\n", checks - failures, checks);
+	return (failures == 0) ? 0 : 1;
+}